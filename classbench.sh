@@ -0,0 +1,51 @@
+#!/bin/bash
+#
+# classbench.sh - builds the driver with each size class spec and compares
+# utilization and throughput on the default traces.  Throughput is the best
+# of a few runs, utilization does not change between runs.  The driver is
+# rebuilt with the default classes at the end.
+#
+# usage: ./classbench.sh [-r RUNS] [SPEC ...]   (default: every classes/*.spec)
+#
+
+runs=3
+if [ "$1" = "-r" ]
+then
+    runs=$2
+    shift 2
+fi
+specs="$@"
+if [ -z "$specs" ]
+then
+    specs=$(ls classes/*.spec)
+fi
+
+printf "%-24s %7s %12s %16s\n" "spec" "classes" "utilization" "throughput"
+for spec in $specs
+do
+    if ! make -s CLASSES=$spec > /dev/null 2>&1
+    then
+        echo "ERROR: build with $spec failed"
+        exit 1
+    fi
+    classes=$(grep "#define CLASS_COUNT" mm_classes.h | awk '{print $3}')
+    best=0
+    for ((i = 0; i < runs; i++))
+    do
+        line=$(./mdriver 2>&1 | grep "Average utilization" | tail -1)
+        if [ -z "$line" ]
+        then
+            echo "ERROR: mdriver failed with $spec"
+            exit 1
+        fi
+        util=$(echo "$line" | sed -e 's/.*utilization = \([0-9.]*\)%.*/\1/')
+        kops=$(echo "$line" | sed -e 's/.*throughput = \([0-9]*\) Kops.*/\1/')
+        if [ $kops -gt $best ]
+        then
+            best=$kops
+        fi
+    done
+    printf "%-24s %7s %11s%% %10s Kops/s\n" $spec $classes $util $best
+done
+
+make -s > /dev/null 2>&1
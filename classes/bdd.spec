@@ -0,0 +1,44 @@
+# generated by classprof.pl, do not edit but run it again:
+#   classprof.pl -n 16 -s 64 -m 131072 -t 4096 -p 1 traces/bdd-aa32.rep traces/bdd-aa4.rep traces/bdd-ma4.rep traces/bdd-nq7.rep
+#
+# requests: 125019, 124887 from slabs, 0 mapped, 132 from the lists
+#
+# most requested block sizes:
+#      472 bytes        54 requests  40.9%
+#     1928 bytes        16 requests  12.1%
+#      264 bytes        14 requests  10.6%
+#      168 bytes         8 requests   6.1%
+#      104 bytes         6 requests   4.5%
+#     8152 bytes         6 requests   4.5%
+#      216 bytes         5 requests   3.8%
+#      120 bytes         4 requests   3.0%
+#     8216 bytes         4 requests   3.0%
+#    32728 bytes         3 requests   2.3%
+#       72 bytes         2 requests   1.5%
+#      280 bytes         2 requests   1.5%
+#      312 bytes         2 requests   1.5%
+#      136 bytes         1 requests   0.8%
+#      184 bytes         1 requests   0.8%
+#      248 bytes         1 requests   0.8%
+#
+# lifetimes (requests from allocation to free), 0 blocks never freed:
+#                 1         5 blocks   3.8%
+#               4-7         1 blocks   0.8%
+#             16-31         6 blocks   4.5%
+#             32-63        17 blocks  12.9%
+#            64-127        10 blocks   7.6%
+#           128-255        15 blocks  11.4%
+#           256-511         9 blocks   6.8%
+#          512-1023        10 blocks   7.6%
+#         1024-2047         7 blocks   5.3%
+#         2048-4095         3 blocks   2.3%
+#         4096-8191        19 blocks  14.4%
+#        8192-16383         6 blocks   4.5%
+#       16384-32767         8 blocks   6.1%
+#       32768-65535         5 blocks   3.8%
+#      65536-131071        11 blocks   8.3%
+
+split 72
+
+104 136 168 216 248 264 312 456 472 776 1024 2048
+4096
@@ -0,0 +1,7 @@
+# fine.spec - one class per 16 bytes up to 1 KiB (bounds 8, 24, 40, ..., 1016,
+# the block sizes), so the first block of a list nearly always fits, then 2048 and 4096
+8 24 40 56 72 88 104 120 136 152 168 184 200 216 232 248
+264 280 296 312 328 344 360 376 392 408 424 440 456 472 488 504
+520 536 552 568 584 600 616 632 648 664 680 696 712 728 744 760
+776 792 808 824 840 856 872 888 904 920 936 952 968 984 1000 1016
+2048 4096
@@ -0,0 +1,3 @@
+# pow2.spec - one class per power of two up to 4096, the classes mm.c
+# has always used.  This is the default
+1 2 4 8 16 32 64 128 256 512 1024 2048 4096
@@ -0,0 +1,9 @@
+# quarter.spec - four classes per power of two from 32 to 1024, which
+# follows the spread of small sizes with a quarter of the lists of fine.spec
+8 16 32
+40 48 56 64
+80 96 112 128
+160 192 224 256
+320 384 448 512
+640 768 896 1024
+2048 4096
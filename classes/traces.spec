@@ -0,0 +1,46 @@
+# generated by classprof.pl, do not edit but run it again:
+#   classprof.pl -n 16 -s 64 -m 131072 -t 4096 -p 1 traces/syn-example-short.rep traces/syn-array-short.rep traces/syn-struct-short.rep traces/syn-string-short.rep traces/syn-mix-short.rep traces/syn-largemem-short.rep traces/ngram-fox1.rep traces/syn-mix-realloc.rep traces/bdd-aa4.rep traces/bdd-aa32.rep traces/bdd-ma4.rep traces/bdd-nq7.rep traces/cbit-abs.rep traces/cbit-parity.rep traces/cbit-satadd.rep traces/cbit-xyz.rep traces/ngram-gulliver1.rep traces/ngram-gulliver2.rep traces/ngram-moby1.rep traces/ngram-shake1.rep traces/syn-array.rep traces/syn-mix.rep traces/syn-string.rep traces/syn-struct.rep
+#
+# requests: 574783, 478419 from slabs, 30 mapped, 96334 from the lists
+#
+# most requested block sizes:
+#       88 bytes      7473 requests   7.8%
+#      104 bytes      7233 requests   7.5%
+#      120 bytes      6266 requests   6.5%
+#      136 bytes      5752 requests   6.0%
+#      152 bytes      5462 requests   5.7%
+#      168 bytes      5092 requests   5.3%
+#      184 bytes      4783 requests   5.0%
+#       72 bytes      4671 requests   4.8%
+#      200 bytes      4471 requests   4.6%
+#      216 bytes      4343 requests   4.5%
+#      232 bytes      4046 requests   4.2%
+#      248 bytes      3886 requests   4.0%
+#      520 bytes      2659 requests   2.8%
+#      264 bytes      1226 requests   1.3%
+#      280 bytes       365 requests   0.4%
+#      328 bytes       322 requests   0.3%
+#
+# lifetimes (requests from allocation to free), 0 blocks never freed:
+#                 1        96 blocks   0.1%
+#               2-3        28 blocks   0.0%
+#               4-7        67 blocks   0.1%
+#              8-15       174 blocks   0.2%
+#             16-31       323 blocks   0.3%
+#             32-63       433 blocks   0.5%
+#            64-127       798 blocks   0.8%
+#           128-255      1253 blocks   1.3%
+#           256-511      2392 blocks   2.5%
+#          512-1023      3937 blocks   4.1%
+#         1024-2047      7126 blocks   7.4%
+#         2048-4095     11323 blocks  11.8%
+#         4096-8191     17356 blocks  18.1%
+#        8192-16383     20958 blocks  21.8%
+#       16384-32767     20473 blocks  21.3%
+#       32768-65535      9153 blocks   9.5%
+#      65536-131071       264 blocks   0.3%
+
+split 72
+
+72 88 104 120 136 152 168 184 200 216 232 248
+344 520 1016 2048 4096
@@ -0,0 +1,246 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+##############################################################################
+#
+# This program reads trace files and writes a size class spec for
+# gen_classes.pl (see classes/README) fitted to them.
+#
+# It builds two histograms over the requests the segregated lists serve
+# (not the slabs, not the mapped requests):
+#
+#   block sizes  the size each malloc, calloc or realloc asks the lists for
+#   lifetimes    requests between a block's allocation and its free
+#
+# The class bounds below 1 KiB are quantiles of the block size histogram,
+# so each list gets about the same share of requests, and a size that alone
+# holds a share gets a list of its own.  Above 1 KiB the classes stay
+# powers of two up to the tree.  The split threshold is the smallest block
+# size that a given share of requests ask for: a free block is not split
+# if the rest would be smaller, since nearly nothing asks for it.
+#
+# The output only depends on the traces and the options, in the order
+# given, so a checked-in spec can be regenerated and compared.
+#
+##############################################################################
+
+$lists = 16;            # lists for block sizes up to 1 KiB
+$slab_max = 64;         # requests up to this many bytes use slabs (MM_OPT_SLAB_MAX)
+$mmap_threshold = 131072;   # requests of at least this many bytes are mapped (MM_OPT_MMAP_THRESHOLD)
+$tree_min = 4096;       # the last bound, blocks above it are tree nodes
+$split_share = 1;       # percent of the requests below the split threshold
+$table_max = 1024;      # largest bound that need not be a power of two (gen_classes.pl)
+$min_block = 24;        # smallest block of the default layout
+$top_sizes = 16;        # block sizes listed in the output
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] [-n LISTS] [-s SLAB_MAX] [-m MMAP_THRESHOLD] [-t TREE_MIN] [-p SPLIT_SHARE] [-o SPEC] TRACE...\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h                 Print this message\n";
+    printf STDERR "  -n LISTS           Lists for block sizes up to 1 KiB (default $lists)\n";
+    printf STDERR "  -s SLAB_MAX        Requests the slabs serve, 0 if they are off (default $slab_max)\n";
+    printf STDERR "  -m MMAP_THRESHOLD  Requests that are mapped, 0 if none are (default $mmap_threshold)\n";
+    printf STDERR "  -t TREE_MIN        Last bound, a power of two from 2048 (default $tree_min)\n";
+    printf STDERR "  -p SPLIT_SHARE     Percent of requests smaller than the split threshold (default $split_share)\n";
+    printf STDERR "  -o SPEC            Spec file to write (default: standard output)\n";
+    die "\n";
+}
+
+getopts('hn:s:m:t:p:o:');
+
+if ($opt_h || !@ARGV) {
+    usage($0);
+}
+$lists = $opt_n if defined($opt_n);
+$slab_max = $opt_s if defined($opt_s);
+$mmap_threshold = $opt_m if defined($opt_m);
+$tree_min = $opt_t if defined($opt_t);
+$split_share = $opt_p if defined($opt_p);
+$lists =~ /^\d+$/ && $lists >= 1 && $lists <= 128 || usage("LISTS must be from 1 to 128");
+$slab_max =~ /^\d+$/ || usage("SLAB_MAX must be a number");
+$mmap_threshold =~ /^\d+$/ || usage("MMAP_THRESHOLD must be a number");
+$tree_min =~ /^\d+$/ && $tree_min >= 2 * $table_max && ($tree_min & ($tree_min - 1)) == 0
+    || usage("TREE_MIN must be a power of two from " . (2 * $table_max));
+$split_share =~ /^\d+$/ && $split_share <= 100 || usage("SPLIT_SHARE must be a percentage");
+
+# the block size mm.c rounds a request to (alignx)
+sub block_size
+{
+    my ($bytes) = @_;
+    my $size = 8 + 16 * int(($bytes + 7) / 16);
+    return $size < $min_block ? $min_block : $size;
+}
+
+# log2 bucket of a lifetime: 0 for 0, k for 2^(k-1) to 2^k - 1
+sub bucket
+{
+    my ($n) = @_;
+    my $k = 0;
+    while ($n > 0) {
+        $n >>= 1;
+        $k++;
+    }
+    return $k;
+}
+
+# only the requests the segregated lists serve are counted
+sub from_lists
+{
+    my ($bytes) = @_;
+    return 0 if $bytes == 0 || $bytes <= $slab_max;
+    return 0 if $mmap_threshold != 0 && $bytes >= $mmap_threshold;
+    return 1;
+}
+
+%sizes = ();            # block size => requests
+%life = ();             # lifetime bucket => blocks freed
+$requests = 0;
+$slabbed = 0;
+$mapped = 0;
+$live_at_end = 0;
+
+sub alloc
+{
+    my ($id, $bytes) = @_;
+    $requests++;
+    if ($bytes != 0 && $bytes <= $slab_max) {
+        $slabbed++;
+    }
+    elsif (!from_lists($bytes)) {
+        $mapped++ if $bytes != 0;
+    }
+    else {
+        $sizes{block_size($bytes)}++;
+    }
+    # a block's lifetime counts if the lists serve its last size
+    $born{$id} = $op if !exists($born{$id});
+    $listed{$id} = from_lists($bytes);
+}
+
+sub release
+{
+    my ($id) = @_;
+    return if !exists($born{$id});
+    $life{bucket($op - $born{$id})}++ if $listed{$id};
+    delete($born{$id});
+    delete($listed{$id});
+}
+
+foreach $trace (@ARGV) {
+    open(TRACE, "<", $trace) || die "$0: couldn't open trace '$trace'\n";
+    # the header: weight, ids, ops, largest live bytes
+    for ($i = 0; $i < 4; $i++) {
+        defined(<TRACE>) || die "$0: $trace: short header\n";
+    }
+    %born = ();         # id => op of its allocation
+    %listed = ();       # id => whether the lists serve it
+    $op = 0;
+    while (<TRACE>) {
+        @f = split;
+        next if !@f;
+        $op++;
+        if ($f[0] eq "a" || $f[0] eq "c") {
+            alloc($f[1], $f[2]);
+        }
+        elsif ($f[0] eq "m") {
+            alloc($f[1], $f[3]);
+        }
+        elsif ($f[0] eq "r") {
+            # the block lives on at its new size
+            alloc($f[1], $f[2]);
+        }
+        elsif ($f[0] eq "f") {
+            release($f[1]);
+        }
+        elsif ($f[0] eq "A") {
+            alloc($f[1] + $_, $f[3]) for (0 .. $f[2] - 1);
+        }
+        elsif ($f[0] eq "F") {
+            release($f[1] + $_) for (0 .. $f[2] - 1);
+        }
+        else {
+            die "$0: $trace:$.: unknown request '$f[0]'\n";
+        }
+    }
+    $live_at_end += grep { $listed{$_} } keys(%born);
+    close(TRACE);
+}
+
+# class bounds: quantiles of the block sizes up to 1 KiB
+@small = sort { $a <=> $b } grep { $_ <= $table_max } keys(%sizes);
+$total = 0;
+$total += $sizes{$_} foreach @small;
+@bounds = ();
+$sum = 0;
+$next = 1;
+for ($i = 0; $i < @small; $i++) {
+    $size = $small[$i];
+    # a size with a share of its own ends the class before it
+    if ($sizes{$size} * $lists >= $total && $i > 0 && (!@bounds || $bounds[-1] < $small[$i - 1])) {
+        push(@bounds, $small[$i - 1]);
+    }
+    $sum += $sizes{$size};
+    if ($sum * $lists >= $next * $total) {
+        push(@bounds, $size) if !@bounds || $bounds[-1] < $size;
+        $next++ while $sum * $lists >= $next * $total;
+    }
+}
+# block sizes are 8 more than a multiple of 16, so a last bound within 16 of 1 KiB covers it
+push(@bounds, $table_max) if !@bounds || $bounds[-1] + 16 <= $table_max;
+for ($bound = 2 * $table_max; $bound <= $tree_min; $bound *= 2) {
+    push(@bounds, $bound);
+}
+
+# split threshold: the smallest block size at least SPLIT_SHARE percent of the requests reach
+@all = sort { $a <=> $b } keys(%sizes);
+$counted = 0;
+$counted += $sizes{$_} foreach @all;
+$split = $min_block;
+$sum = 0;
+foreach $size (@all) {
+    $sum += $sizes{$size};
+    if ($sum * 100 >= $split_share * $counted) {
+        $split = $size;
+        last;
+    }
+}
+$split = $table_max if $split > $table_max;
+
+# the spec, with the histograms as comments
+$out = "# generated by classprof.pl, do not edit but run it again:\n"
+    . "#   classprof.pl -n $lists -s $slab_max -m $mmap_threshold -t $tree_min -p $split_share " . join(" ", @ARGV) . "\n"
+    . "#\n"
+    . "# requests: $requests, $slabbed from slabs, $mapped mapped, $counted from the lists\n"
+    . "#\n"
+    . "# most requested block sizes:\n";
+@top = sort { $sizes{$b} <=> $sizes{$a} || $a <=> $b } keys(%sizes);
+splice(@top, $top_sizes) if @top > $top_sizes;
+foreach $size (@top) {
+    $out .= sprintf("# %8d bytes %9d requests %5.1f%%\n", $size, $sizes{$size}, 100 * $sizes{$size} / ($counted || 1));
+}
+$freed = 0;
+$freed += $life{$_} foreach keys(%life);
+$out .= "#\n"
+    . "# lifetimes (requests from allocation to free), $live_at_end blocks never freed:\n";
+foreach $k (sort { $a <=> $b } keys(%life)) {
+    $range = $k <= 1 ? $k : (1 << ($k - 1)) . "-" . ((1 << $k) - 1);
+    $out .= sprintf("# %17s %9d blocks %5.1f%%\n", $range, $life{$k}, 100 * $life{$k} / ($freed || 1));
+}
+$out .= "\n"
+    . "split $split\n"
+    . "\n";
+for ($i = 0; $i < @bounds; $i += 12) {
+    $end = $i + 11 < $#bounds ? $i + 11 : $#bounds;
+    $out .= join(" ", @bounds[$i .. $end]) . "\n";
+}
+
+if (defined($opt_o)) {
+    open(OUT, ">", $opt_o) || die "$0: couldn't write '$opt_o'\n";
+    print OUT $out;
+    close(OUT);
+}
+else {
+    print $out;
+}
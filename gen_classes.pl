@@ -0,0 +1,130 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+##############################################################################
+#
+# This program reads a size class spec (see classes/README) and writes the
+# header mm.c maps block sizes to segregated lists with:
+#
+#   class_table  one entry per 8 bytes up to CLASS_TABLE_MAX, read directly
+#   class_log2   one entry per power of two above it, read through clz
+#
+# and the split threshold of a "split <bytes>" line as CLASS_SPLIT_MIN.
+# Above CLASS_TABLE_MAX every bound must be a power of two, so that a class
+# never splits a power-of-two range.  The output is only rewritten when it
+# changes, so switching specs rebuilds mm.o and nothing else.
+#
+##############################################################################
+
+$table_max = 1024;      # sizes up to this many bytes use the table
+$table_log2 = 10;
+$table_shift = 3;       # block sizes are multiples of 8
+$max_classes = 255;     # entries are unsigned chars
+$tree_min_bound = 64;   # blocks above the last bound are tree nodes
+
+sub usage 
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] -o OUTFILE SPEC\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h          Print this message\n";
+    printf STDERR "  -o OUTFILE  Header to write\n";
+    die "\n";
+}
+
+getopts('ho:');
+
+if ($opt_h || !$opt_o || @ARGV != 1) {
+    usage($0);
+}
+$spec = $ARGV[0];
+
+open(SPEC, "<", $spec) || die "$0: couldn't open spec file '$spec'\n";
+@bounds = ();
+$split = 0;
+while (<SPEC>) {
+    s/#.*//;
+    if (/^\s*split\s+(\d+)\s*$/) {
+        $split = $1;
+        next;
+    }
+    foreach $word (split) {
+        $word =~ /^\d+$/ || die "$0: $spec:$.: '$word' is not a size\n";
+        push(@bounds, $word);
+    }
+}
+close(SPEC);
+
+# check the bounds
+@bounds || die "$0: $spec: no bounds\n";
+for ($i = 0; $i < @bounds; $i++) {
+    $bounds[$i] > 0 || die "$0: $spec: bounds must be positive\n";
+    $i == 0 || $bounds[$i] > $bounds[$i - 1] || die "$0: $spec: bound $bounds[$i] is not above $bounds[$i - 1]\n";
+    if ($bounds[$i] > $table_max && ($bounds[$i] & ($bounds[$i] - 1)) != 0) {
+        die "$0: $spec: bound $bounds[$i] is above $table_max but not a power of two\n";
+    }
+}
+# the tree keeps its three links in the payload, too small a node has no room
+$bounds[-1] >= $tree_min_bound || die "$0: $spec: the last bound must be at least $tree_min_bound\n";
+$num_classes = @bounds + 1;     # the last class, above every bound, is the tree
+$num_classes <= $max_classes || die "$0: $spec: more than $max_classes classes\n";
+
+# the class of a size: the first bound at least as large, else the tree
+sub class_of
+{
+    my ($size) = @_;
+    for (my $c = 0; $c < @bounds; $c++) {
+        return $c if $size <= $bounds[$c];
+    }
+    return scalar(@bounds);
+}
+
+# table entry i holds sizes 8i+1 to 8i+8, of which only 8i+8 is a block size
+@table = ();
+for ($i = 0; $i < ($table_max >> $table_shift); $i++) {
+    push(@table, class_of(($i + 1) << $table_shift));
+}
+# log2 entry k holds sizes 2^k+1 to 2^(k+1)
+@log2 = ();
+for ($k = 0; $k < 64; $k++) {
+    push(@log2, $k < $table_log2 ? 0 : class_of($k >= 63 ? ~0 : 1 << ($k + 1)));
+}
+
+sub rows
+{
+    my $out = "";
+    for (my $i = 0; $i < @_; $i += 16) {
+        my $end = $i + 15 < $#_ ? $i + 15 : $#_;
+        $out .= "    " . join(", ", @_[$i .. $end]) . ($end < $#_ ? ",\n" : "\n");
+    }
+    return $out;
+}
+
+$header = "/* Generated by gen_classes.pl from $spec, do not edit */\n"
+    . "#ifndef MM_CLASSES_H\n"
+    . "#define MM_CLASSES_H\n"
+    . "\n"
+    . "#define CLASS_SPEC \"$spec\"\n"
+    . "#define CLASS_COUNT $num_classes      // segregated lists, then the tree of the sizes above $bounds[-1]\n"
+    . "#define CLASS_TREE_MIN " . ($bounds[-1] + 1) . "\n"
+    . "#define CLASS_TABLE_MAX $table_max    // sizes up to this use class_table, larger ones class_log2\n"
+    . "#define CLASS_TABLE_SHIFT $table_shift\n"
+    . "#define CLASS_SPLIT_MIN $split     // a free block is split only if the rest is at least this large\n"
+    . "\n"
+    . "// class of the sizes 8i+1 to 8i+8\n"
+    . "static const unsigned char class_table[" . scalar(@table) . "] = {\n" . rows(@table) . "};\n"
+    . "\n"
+    . "// class of the sizes 2^k+1 to 2^(k+1), for sizes above CLASS_TABLE_MAX\n"
+    . "static const unsigned char class_log2[64] = {\n" . rows(@log2) . "};\n"
+    . "\n"
+    . "#endif /* MM_CLASSES_H */\n";
+
+if (open(OLD, "<", $opt_o)) {
+    local $/;
+    $old = <OLD>;
+    close(OLD);
+    exit(0) if $old eq $header;
+}
+open(OUT, ">", $opt_o) || die "$0: couldn't write '$opt_o'\n";
+print OUT $header;
+close(OUT);
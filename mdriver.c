@@ -34,6 +34,8 @@
 /* Misc */
 #define MAXLINE     1024          /* max string size */
 #define HDRLINES       4          /* number of header lines in a trace file */
+#define FIT_STEP      16          /* -F: request sizes are probed every FIT_STEP bytes ... */
+#define FIT_MAX     8192          /* ... up to FIT_MAX */
 #define LINENUM(i) (i+HDRLINES+1) /* cnvt trace request nums to linenums (origin 1) */
 
 #ifndef REF_ONLY
@@ -80,9 +82,12 @@ typedef struct {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    enum { ALLOC, FREE, REALLOC, BATCH_ALLOC, BATCH_FREE } type; /* type of request */
     long index;                         /* index for free() to use later */
     size_t size;                        /* byte size of alloc/realloc request */
+    size_t count;                       /* batch requests: ids index .. index+count-1 */
+    size_t alignment;                   /* ALLOC: payload alignment for mm_memalign, 0 for mm_malloc */
+    bool zero;                          /* ALLOC: mm_calloc, the block must read zero */
 } traceop_t;
 
 /* Holds the information for one trace file */
@@ -91,11 +96,13 @@ typedef struct {
     size_t data_bytes;    /* Peak number of data bytes allocated during trace */
     int num_ids;          /* number of alloc/realloc ids */
     int num_ops;          /* number of distinct requests */
+    long num_requests;    /* allocator calls they stand for, a batch counts once per block */
     weight_t weight;      /* weight for this trace */
     traceop_t *ops;       /* array of requests */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     int *block_rand_base; /* index into random_data, if debug is on */
+    char **batch;         /* scratch array for mm_free_batch, which sorts it */
 } trace_t;
 
 /*
@@ -120,6 +127,12 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    double peak_heap;  /* largest heap footprint (brk heap + mappings) in bytes */
+    double avg_heap;   /* heap footprint averaged over the requests of the trace */
+    double avg_util;   /* payload averaged over the requests, divided by avg_heap */
+    double resident;   /* pages of the heap and mappings in memory after the last request */
+    double sbrks;      /* calls to mm_sbrk and mm_arena_sbrk during the trace */
+    double reallocs;   /* calls to mm_realloc, fewer with -U */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -159,6 +172,10 @@ int verbose = REF_ONLY ? 0 : 1;  /* global flag for verbose output */
 static int errors = 0;           /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
+static bool memory_mode = false;  /* Print the heap footprint of each trace as well */
+static bool sized_free = false;   /* FREE requests call mm_free_sized with the block's size */
+static bool usable_realloc = false; /* REALLOC requests within mm_malloc_usable_size keep the block */
+static bool fit_mode = false;     /* Print the fit each size class ends a trace with */
 static size_t maxfill = MAXFILL;
 
 /* by default, no timeouts */
@@ -182,6 +199,38 @@ static char **global_tracefiles = NULL;
 static sum_stats_t global_libc_sum_stats;
 static sum_stats_t global_mm_sum_stats;
 
+/*
+ * Allocator tunables that can be set on the command line with
+ * -o <name>=<value>.  A value is a number or one of the symbolic
+ * names in mm_option_values.
+ */
+typedef struct {
+    const char *name;
+    int value;
+} name_value_t;
+
+static const name_value_t mm_option_names[] = {
+    { "policy", MM_OPT_POLICY },
+    { "slab_max", MM_OPT_SLAB_MAX },
+    { "tcache_count", MM_OPT_TCACHE_COUNT },
+    { "mmap_threshold", MM_OPT_MMAP_THRESHOLD },
+    { "trim_threshold", MM_OPT_TRIM_THRESHOLD },
+    { "purge_threshold", MM_OPT_PURGE_THRESHOLD },
+    { "grow_max", MM_OPT_GROW_MAX },
+    { "quick_budget", MM_OPT_QUICK_BUDGET },
+    { "layout", MM_OPT_LAYOUT },
+    { "fit_adapt", MM_OPT_FIT_ADAPT },
+    { NULL, 0 }
+};
+
+static const name_value_t mm_option_values[] = {
+    { "seglist", MM_POLICY_SEGLIST },
+    { "tlsf", MM_POLICY_TLSF },
+    { "wide", MM_LAYOUT_WIDE },
+    { "compact", MM_LAYOUT_COMPACT },
+    { NULL, 0 }
+};
+
 /* Performance statistics for driver */
 
 /*********************
@@ -191,6 +240,9 @@ static sum_stats_t global_mm_sum_stats;
 /* This function enables generating the set of trace files */
 static void add_tracefile(char *trace);
 
+/* This function passes a -o <name>=<value> setting to mm_mallopt */
+static void set_mm_option(char *setting);
+
 /* these functions manipulate range sets */
 static range_set_t *new_range_set();
 static bool add_range(range_set_t *ranges, char *lo, size_t size,
@@ -216,11 +268,18 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static bool realloc_fits(char *oldp, size_t oldsize, size_t size);
+static char *alloc_block(const traceop_t *op);
+static char *libc_alloc_block(const traceop_t *op);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printmemory(int n, stats_t *stats);
+#if !REF_ONLY
+static void printfits(const trace_t *trace);
+#endif
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -262,7 +321,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         trace_t *trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+        mm_stats[i].ops = trace->num_requests;
 
         /* Prepare for timeout */
         if (set_timeout > 0) {
@@ -285,7 +344,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
             speed_params->trace = trace;
             if (verbose > 1)
                 printf("and performance.\n");
@@ -359,7 +418,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hOVlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:o:hOVlDTmSUF")) != EOF) {
         switch (c) {
 
             case 'f': /* Use one specific trace file only (relative to curr dir) */
@@ -409,6 +468,26 @@ int main(int argc, char **argv)
                 tab_mode = true;
                 break;
 
+            case 'm': /* Print the heap footprint of each trace */
+                memory_mode = true;
+                break;
+
+            case 'o': /* Set an allocator tunable */
+                set_mm_option(optarg);
+                break;
+
+            case 'S': /* Free with mm_free_sized */
+                sized_free = true;
+                break;
+
+            case 'U': /* Skip the reallocs the usable size already covers */
+                usable_realloc = true;
+                break;
+
+            case 'F': /* Print the fit of each size class after the trace */
+                fit_mode = true;
+                break;
+
             case 'h': /* Print this message */
                 usage(argv[0]);
                 exit(0);
@@ -520,6 +599,11 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (memory_mode) {
+                printf("Heap footprint for mm malloc:\n");
+                printmemory(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
@@ -678,6 +762,39 @@ static void add_tracefile(char *trace) {
     global_tracefiles[num_global_tracefiles++] = strdup(trace);
 }
 
+/*****************************************************************
+ * Parse a -o <name>=<value> setting and pass it to mm_mallopt
+ ****************************************************************/
+static void set_mm_option(char *setting) {
+    const name_value_t *opt, *val;
+    char *value = strchr(setting, '=');
+    char *end;
+    long v;
+
+    if (value == NULL)
+        app_error("Option '%s' is not of the form <name>=<value>\n", setting);
+    *value++ = '\0';
+
+    for (opt = mm_option_names; opt->name; opt++)
+        if (strcmp(opt->name, setting) == 0)
+            break;
+    if (opt->name == NULL)
+        app_error("Unknown allocator option '%s'\n", setting);
+
+    v = strtol(value, &end, 0);
+    if (*value == '\0' || *end != '\0') {
+        for (val = mm_option_values; val->name; val++)
+            if (strcmp(val->name, value) == 0)
+                break;
+        if (val->name == NULL)
+            app_error("Bad value '%s' for allocator option '%s'\n", value, setting);
+        v = val->value;
+    }
+
+    if (!mm_mallopt(opt->value, (int) v))
+        app_error("mm_mallopt rejected %s=%s\n", setting, value);
+}
+
 
 
 /*****************************************************************
@@ -715,11 +832,13 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or within
+       one of the regions the package mapped with mm_mmap */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_in_mapping(lo, hi)) {
         malloc_error(trace, opnum,
-                     "Payload (%p:%p) lies outside heap (%p:%p)",
+                     "Payload (%p:%p) lies outside heap (%p:%p) and every mapping",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
         return false;
     }
@@ -937,6 +1056,8 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     char type[MAXLINE];
     int index;
     size_t size;
+    size_t count;
+    size_t alignment;
     int max_index = 0;
     int op_index;
     int ignore = 0;
@@ -989,7 +1110,12 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
+    trace->num_requests = 0;
+    trace->batch = NULL;
+    size_t max_count = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+        trace->ops[op_index].alignment = 0;
+        trace->ops[op_index].zero = false;
         switch(type[0]) {
             case 'a':
                 ignore += fscanf(tracefile, "%u %lu", &index, &size);
@@ -998,6 +1124,26 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
                 trace->ops[op_index].size = size;
                 max_index = (index > max_index) ? index : max_index;
                 break;
+            case 'm':
+                ignore += fscanf(tracefile, "%u %zu %lu", &index, &alignment, &size);
+                if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+                    app_error("Alignment %zu is not a power of two in tracefile %s\n",
+                              alignment, trace->filename);
+                }
+                trace->ops[op_index].type = ALLOC;
+                trace->ops[op_index].index = index;
+                trace->ops[op_index].size = size;
+                trace->ops[op_index].alignment = alignment;
+                max_index = (index > max_index) ? index : max_index;
+                break;
+            case 'c':
+                ignore += fscanf(tracefile, "%u %lu", &index, &size);
+                trace->ops[op_index].type = ALLOC;
+                trace->ops[op_index].index = index;
+                trace->ops[op_index].size = size;
+                trace->ops[op_index].zero = true;
+                max_index = (index > max_index) ? index : max_index;
+                break;
             case 'r':
                 ignore += fscanf(tracefile, "%u %lu", &index, &size);
                 trace->ops[op_index].type = REALLOC;
@@ -1010,21 +1156,49 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
                 trace->ops[op_index].type = FREE;
                 trace->ops[op_index].index = index;
                 break;
+            case 'A':
+                ignore += fscanf(tracefile, "%u %zu %lu", &index, &count, &size);
+                trace->ops[op_index].type = BATCH_ALLOC;
+                trace->ops[op_index].index = index;
+                trace->ops[op_index].count = count;
+                trace->ops[op_index].size = size;
+                max_index = (index + (int)count - 1 > max_index) ? index + (int)count - 1 : max_index;
+                break;
+            case 'F':
+                ignore += fscanf(tracefile, "%u %zu", &index, &count);
+                trace->ops[op_index].type = BATCH_FREE;
+                trace->ops[op_index].index = index;
+                trace->ops[op_index].count = count;
+                break;
             default:
                 app_error("Bogus type character (%c) in tracefile %s\n",
                           type[0], trace->filename);
         }
+        if (type[0] == 'A' || type[0] == 'F') {
+            if (count == 0) {
+                app_error("Empty batch in tracefile %s\n", trace->filename);
+            }
+            trace->num_requests += count;
+            max_count = (count > max_count) ? count : max_count;
+        } else {
+            trace->num_requests++;
+        }
         op_index++;
         if (op_index == trace->num_ops) break;
     }
     fclose(tracefile);
+
+    /* the batch frees sort their pointers, so they are copied here first */
+    if (max_count != 0 &&
+        (trace->batch = (char **)malloc(max_count * sizeof(char *))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+    stats->ops = trace->num_requests;
 
     return trace;
 }
@@ -1040,7 +1214,7 @@ static void reinit_trace(trace_t *trace)
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
+ * free_trace - Free the trace record and the arrays it points
  *              to, all of which were allocated in read_trace().
  */
 static void free_trace(trace_t *trace)
@@ -1049,6 +1223,7 @@ static void free_trace(trace_t *trace)
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->batch);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -1065,6 +1240,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     int i;
     int index;
     size_t size;
+    size_t j, count;
     char *newp;
     char *oldp;
     char *p;
@@ -1084,6 +1260,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     for (i = 0;  i < trace->num_ops;  i++) {
         index = trace->ops[i].index;
         size = trace->ops[i].size;
+        count = trace->ops[i].count;
 
         if (debug_mode == DBG_EXPENSIVE) {
             range_t *r;
@@ -1105,13 +1282,27 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 
         switch (trace->ops[i].type) {
 
-            case ALLOC: /* mm_malloc */
+            case ALLOC: /* mm_malloc, mm_memalign for an aligned request or mm_calloc */
 
                 /* Call the student's malloc */
-                if ((p = mm_malloc(size)) == NULL) {
+                if ((p = alloc_block(&trace->ops[i])) == NULL) {
                     malloc_error(trace, i, "mm_malloc failed.");
                     return false;
                 }
+                if (trace->ops[i].alignment != 0 &&
+                    (uintptr_t)p % trace->ops[i].alignment != 0) {
+                    malloc_error(trace, i, "Payload address (%p) not aligned to %zu bytes",
+                                 p, trace->ops[i].alignment);
+                    return false;
+                }
+                if (trace->ops[i].zero) {
+                    for (j = 0; j < size; j++) {
+                        if (p[j] != 0) {
+                            malloc_error(trace, i, "mm_calloc block has a nonzero byte at offset %zu", j);
+                            return false;
+                        }
+                    }
+                }
 
                 /*
                  * Test the range of the new block for correctness and add it
@@ -1133,9 +1324,12 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                 if (!check_index(trace, i, index, 0))
                     return false;
 
-                /* Call the student's realloc */
+                /* Call the student's realloc, unless -U and the block already fits */
                 oldp = trace->blocks[index];
-                newp = mm_realloc(oldp, size);
+                if (realloc_fits(oldp, trace->block_sizes[index], size))
+                    newp = oldp;
+                else
+                    newp = mm_realloc(oldp, size);
                 if ( (newp == NULL) && (size != 0) ) {
                     malloc_error(trace, i, "mm_realloc failed.");
                     return false;
@@ -1183,7 +1377,33 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                     p = trace->blocks[index];
                     remove_range(ranges, p);
                 }
-                mm_free(p);
+                if (sized_free && p != NULL)
+                    mm_free_sized(p, trace->block_sizes[index]);
+                else
+                    mm_free(p);
+                break;
+
+            case BATCH_ALLOC: /* mm_malloc_batch */
+                if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) != count) {
+                    malloc_error(trace, i, "mm_malloc_batch failed.");
+                    return false;
+                }
+                for (j = 0; j < count; j++) {
+                    if (add_range(ranges, trace->blocks[index + j], size, trace, i, index + j) == 0)
+                        return false;
+                    trace->block_sizes[index + j] = size;
+                    randomize_block(trace, index + j);
+                }
+                break;
+
+            case BATCH_FREE: /* mm_free_batch */
+                for (j = 0; j < count; j++) {
+                    if (!check_index(trace, i, index + j, 0))
+                        return false;
+                    remove_range(ranges, trace->blocks[index + j]);
+                    trace->batch[j] = trace->blocks[index + j];
+                }
+                mm_free_batch((void **)trace->batch, count);
                 break;
 
             default:
@@ -1199,28 +1419,41 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   largest footprint of the student's malloc package on the trace:
+ *   the size of the brk heap plus the size of the regions it has
+ *   mapped with mm_mmap at the same time.
  *
  *   A higher number is better: 1 is optimal.
+ *
+ *   Because the heap can shrink, the peak alone does not show how much
+ *   memory the package holds most of the time.  The footprint and the
+ *   payload are therefore also averaged over the requests and recorded
+ *   in stats (peak_heap, avg_heap, avg_util).  So is the number of pages
+ *   still resident after the last request (mincore), which shows what
+ *   trimming and purging give back, and the number of sbrk calls, which
+ *   shows how the heap grew.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
     int i;
     int index;
     size_t size, newsize, oldsize;
+    size_t j, count;
     size_t max_total_size = 0;
     size_t total_size = 0;
     size_t max_heap_size = 0;
     size_t heap_size = 0;
+    double sum_total_size = 0;
+    double sum_heap_size = 0;
+    size_t reallocs = 0;
     char *p;
     char *newp, *oldp;
 
     reinit_trace(trace);
 
-    /* initialize the heap and the mm malloc package */
+    /* initialize the heap and the mm malloc package, with no page
+       left resident by the runs before */
+    mem_release();
     mem_reset_brk();
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
@@ -1232,7 +1465,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
 
-                if ((p = mm_malloc(size)) == NULL) {
+                if ((p = alloc_block(&trace->ops[i])) == NULL) {
                     app_error("trace %d: mm_malloc failed in eval_mm_util",
                               tracenum);
                 }
@@ -1250,9 +1483,14 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 oldsize = trace->block_sizes[index];
 
                 oldp = trace->blocks[index];
-                if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
-                    app_error("trace %d: mm_realloc failed in eval_mm_util",
-                              tracenum);
+                if (realloc_fits(oldp, oldsize, newsize)) {
+                    newp = oldp;
+                } else {
+                    reallocs++;
+                    if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
+                        app_error("trace %d: mm_realloc failed in eval_mm_util",
+                                  tracenum);
+                    }
                 }
 
                 /* Remember region and size */
@@ -1272,11 +1510,38 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                     p = trace->blocks[index];
                 }
 
-                mm_free(p);
+                if (sized_free && p != NULL)
+                    mm_free_sized(p, size);
+                else
+                    mm_free(p);
 
                 total_size -= size;
                 break;
 
+            case BATCH_ALLOC: /* mm_malloc_batch */
+                index = trace->ops[i].index;
+                size = trace->ops[i].size;
+                count = trace->ops[i].count;
+                if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) != count) {
+                    app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                              tracenum);
+                }
+                for (j = 0; j < count; j++) {
+                    trace->block_sizes[index + j] = size;
+                }
+                total_size += size * count;
+                break;
+
+            case BATCH_FREE: /* mm_free_batch */
+                index = trace->ops[i].index;
+                count = trace->ops[i].count;
+                for (j = 0; j < count; j++) {
+                    trace->batch[j] = trace->blocks[index + j];
+                    total_size -= trace->block_sizes[index + j];
+                }
+                mm_free_batch((void **)trace->batch, count);
+                break;
+
             default:
                 app_error("trace %d: Nonexistent request type in eval_mm_util",
                           tracenum);
@@ -1285,12 +1550,23 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
-        heap_size = mem_heapsize();
+        heap_size = mem_heapsize() + mem_mapped_size();
         max_heap_size = (heap_size > max_heap_size) ?
             heap_size : max_heap_size;
+        sum_total_size += total_size;
+        sum_heap_size += heap_size;
     }
 
+    stats->peak_heap = max_heap_size;
+    stats->avg_heap = trace->num_ops ? sum_heap_size / trace->num_ops : 0;
+    stats->avg_util = sum_heap_size ? sum_total_size / sum_heap_size : 0;
+    stats->resident = mem_resident_pages();
+    stats->sbrks = mem_sbrk_calls();
+    stats->reallocs = reallocs;
+
 #if !REF_ONLY
+    if (fit_mode)
+        printfits(trace);
     printf(".");
 #endif
 
@@ -1306,6 +1582,7 @@ static void eval_mm_speed(void *ptr)
 {
     int i, index;
     size_t size, newsize;
+    size_t j, count;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
@@ -1322,18 +1599,22 @@ static void eval_mm_speed(void *ptr)
             case ALLOC: /* mm_malloc */
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
-                if ((p = mm_malloc(size)) == NULL)
+                if ((p = alloc_block(&trace->ops[i])) == NULL)
                     app_error("mm_malloc error in eval_mm_speed");
                 trace->blocks[index] = p;
+                trace->block_sizes[index] = size;   /* for -S */
                 break;
 
             case REALLOC: /* mm_realloc */
                 index = trace->ops[i].index;
                 newsize = trace->ops[i].size;
                 oldp = trace->blocks[index];
-                if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+                if (realloc_fits(oldp, trace->block_sizes[index], newsize))
+                    newp = oldp;
+                else if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
                     app_error("mm_realloc error in eval_mm_speed");
                 trace->blocks[index] = newp;
+                trace->block_sizes[index] = newsize;
                 break;
 
             case FREE: /* mm_free */
@@ -1343,7 +1624,30 @@ static void eval_mm_speed(void *ptr)
                 } else {
                     block = trace->blocks[index];
                 }
-                mm_free(block);
+                if (sized_free && block != NULL)
+                    mm_free_sized(block, trace->block_sizes[index]);
+                else
+                    mm_free(block);
+                break;
+
+            case BATCH_ALLOC: /* mm_malloc_batch */
+                index = trace->ops[i].index;
+                size = trace->ops[i].size;
+                count = trace->ops[i].count;
+                if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) != count)
+                    app_error("mm_malloc_batch error in eval_mm_speed");
+                for (j = 0; j < count; j++) {
+                    trace->block_sizes[index + j] = size;
+                }
+                break;
+
+            case BATCH_FREE: /* mm_free_batch */
+                index = trace->ops[i].index;
+                count = trace->ops[i].count;
+                for (j = 0; j < count; j++) {
+                    trace->batch[j] = trace->blocks[index + j];
+                }
+                mm_free_batch((void **)trace->batch, count);
                 break;
 
             default:
@@ -1351,6 +1655,49 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * realloc_fits - with -U, a realloc that grows a block within what the
+ *    block of oldp can already hold is not made: the caller keeps using
+ *    the block, as a vector that asks mm_malloc_usable_size first would.
+ *    Shrinking reallocs are still made, they may give memory back
+ */
+static bool realloc_fits(char *oldp, size_t oldsize, size_t size)
+{
+    return usable_realloc && oldp != NULL && size >= oldsize &&
+           size <= mm_malloc_usable_size(oldp);
+}
+
+/*
+ * alloc_block - the mm call for an allocation request: mm_malloc,
+ *    mm_memalign if the request ('m' in the trace) carries an alignment,
+ *    or mm_calloc if it must read zero ('c')
+ */
+static char *alloc_block(const traceop_t *op)
+{
+    if (op->zero)
+        return mm_calloc(1, op->size);
+    if (op->alignment != 0)
+        return mm_memalign(op->alignment, op->size);
+    return mm_malloc(op->size);
+}
+
+/*
+ * libc_alloc_block - the same for libc, which aligns with posix_memalign
+ */
+static char *libc_alloc_block(const traceop_t *op)
+{
+    void *p;
+
+    if (op->zero)
+        return calloc(1, op->size);
+    if (op->alignment == 0)
+        return malloc(op->size);
+    if (posix_memalign(&p, op->alignment < sizeof(void *) ? sizeof(void *) : op->alignment,
+                       op->size) != 0)
+        return NULL;
+    return p;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1361,6 +1708,7 @@ static bool eval_libc_valid(trace_t *trace)
 {
     int i;
     size_t newsize;
+    size_t j;
     char *p, *newp, *oldp;
 
     reinit_trace(trace);
@@ -1369,7 +1717,7 @@ static bool eval_libc_valid(trace_t *trace)
         switch (trace->ops[i].type) {
 
             case ALLOC: /* malloc */
-                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                if ((p = libc_alloc_block(&trace->ops[i])) == NULL) {
                     malloc_error(trace, i, "libc malloc failed");
                     unix_error("System message");
                 }
@@ -1394,6 +1742,22 @@ static bool eval_libc_valid(trace_t *trace)
                 }
                 break;
 
+            case BATCH_ALLOC: /* one malloc per block */
+                for (j = 0; j < trace->ops[i].count; j++) {
+                    if ((p = malloc(trace->ops[i].size)) == NULL) {
+                        malloc_error(trace, i, "libc malloc failed");
+                        unix_error("System message");
+                    }
+                    trace->blocks[trace->ops[i].index + j] = p;
+                }
+                break;
+
+            case BATCH_FREE: /* one free per block */
+                for (j = 0; j < trace->ops[i].count; j++) {
+                    free(trace->blocks[trace->ops[i].index + j]);
+                }
+                break;
+
             default:
                 app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1412,6 +1776,7 @@ static void eval_libc_speed(void *ptr)
     int i;
     int index;
     size_t size, newsize;
+    size_t j;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -1421,8 +1786,7 @@ static void eval_libc_speed(void *ptr)
         switch (trace->ops[i].type) {
             case ALLOC: /* malloc */
                 index = trace->ops[i].index;
-                size = trace->ops[i].size;
-                if ((p = malloc(size)) == NULL)
+                if ((p = libc_alloc_block(&trace->ops[i])) == NULL)
                     unix_error("malloc failed in eval_libc_speed");
                 trace->blocks[index] = p;
                 break;
@@ -1446,6 +1810,23 @@ static void eval_libc_speed(void *ptr)
                     free(0);
                 }
                 break;
+
+            case BATCH_ALLOC: /* one malloc per block */
+                index = trace->ops[i].index;
+                size = trace->ops[i].size;
+                for (j = 0; j < trace->ops[i].count; j++) {
+                    if ((p = malloc(size)) == NULL)
+                        unix_error("malloc failed in eval_libc_speed");
+                    trace->blocks[index + j] = p;
+                }
+                break;
+
+            case BATCH_FREE: /* one free per block */
+                index = trace->ops[i].index;
+                for (j = 0; j < trace->ops[i].count; j++) {
+                    free(trace->blocks[index + j]);
+                }
+                break;
         }
     }
 }
@@ -1620,6 +2001,88 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+#if !REF_ONLY
+/*
+ * printfits - print the fit (mm_fit_policy) the free lists of the
+ *     student's package use at the end of a trace, as runs of request
+ *     sizes that search lists with the same fit
+ */
+static void printfits(const trace_t *trace)
+{
+    static const char *names[] = { "first", "best_of", "address", "tlsf" };
+    size_t start = 1;
+    int fit = mm_fit_policy(start);
+
+    printf("\n%s:", trace->filename);
+    for (size_t size = FIT_STEP + 1; ; size += FIT_STEP) {
+        int next = size <= FIT_MAX ? mm_fit_policy(size) : -2;
+        if (next == fit)
+            continue;
+        if (fit == -1)
+            printf(" %zu-%zu tree", start, size - 1);
+        else
+            printf(" %zu-%zu %s", start, size - 1, names[fit]);
+        if (next == -2)
+            break;
+        start = size;
+        fit = next;
+    }
+    printf("\n");
+}
+#endif
+
+/*
+ * printmemory - print the heap footprint of the student's package on
+ *     each trace next to its utilization: the peak, the average over
+ *     the requests, the average payload over the average footprint, the
+ *     pages still resident after the last request, the sbrk calls and
+ *     the realloc calls
+ */
+static void printmemory(int n, stats_t *stats)
+{
+    int i;
+    double sumavgutil = 0;
+    int num_valid = 0;
+
+    if (tab_mode) {
+        printf("valid\tutil\tpeakKB\tavgKB\tavgutil\tpages\tsbrks\treallocs\ttrace\n");
+    } else {
+        printf("  %5s %8s %10s %10s %8s %8s %8s %8s  %s\n",
+               "valid", "util", "peak KB", "avg KB", "avgutil", "pages", "sbrks", "reallocs", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid) {
+            if (tab_mode) {
+                printf("no\t\t\t\t\t\t\t\t%s\n", stats[i].filename);
+            } else {
+                printf("  %5s %8s %10s %10s %8s %8s %8s %8s  %s\n",
+                       "no", "-", "-", "-", "-", "-", "-", "-", stats[i].filename);
+            }
+            continue;
+        }
+        if (tab_mode) {
+            printf("1\t%.1f\t%.0f\t%.0f\t%.1f\t%.0f\t%.0f\t%.0f\t%s\n", stats[i].util * 100.0,
+                   stats[i].peak_heap / 1024.0, stats[i].avg_heap / 1024.0,
+                   stats[i].avg_util * 100.0, stats[i].resident, stats[i].sbrks, stats[i].reallocs,
+                   stats[i].filename);
+        } else {
+            printf("  %5s %7.1f%% %10.0f %10.0f %7.1f%% %8.0f %8.0f %8.0f  %s\n", "yes", stats[i].util * 100.0,
+                   stats[i].peak_heap / 1024.0, stats[i].avg_heap / 1024.0,
+                   stats[i].avg_util * 100.0, stats[i].resident, stats[i].sbrks, stats[i].reallocs,
+                   stats[i].filename);
+        }
+        sumavgutil += stats[i].avg_util;
+        num_valid++;
+    }
+    if (num_valid > 0) {
+        if (tab_mode) {
+            printf("Avg\t\t\t\t%.1f\n", sumavgutil / num_valid * 100.0);
+        } else {
+            printf("  %5s %8s %10s %10s %7.1f%%\n", "", "", "", "", sumavgutil / num_valid * 100.0);
+        }
+    }
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1831,7 +2294,7 @@ static double measure_ref_throughput() {
  */
 static void usage(char *prog)
 {
-    fprintf(stderr, "Usage: %s [-hlVdD] [-f <file>]\n", prog);
+    fprintf(stderr, "Usage: %s [-hlVdDSU] [-f <file>]\n", prog);
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
@@ -1843,5 +2306,20 @@ static void usage(char *prog)
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
+    fprintf(stderr, "\t-m         Print the peak and time-averaged heap footprint and the resident pages, sbrk and realloc calls of each trace\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-S         Free with mm_free_sized, passing the size of the block's last request\n");
+    fprintf(stderr, "\t-U         Skip a realloc when mm_malloc_usable_size says the block already fits\n");
+    fprintf(stderr, "\t-F         Print the fit each size class of the free lists ends a trace with\n");
+    fprintf(stderr, "\t-o <n>=<v> Set allocator option <n> to <v> before mm_init:\n");
+    fprintf(stderr, "\t           policy=seglist|tlsf  free-block index\n");
+    fprintf(stderr, "\t           slab_max=0..64       largest request served by slabs\n");
+    fprintf(stderr, "\t           tcache_count=0..255  blocks per thread cache bin\n");
+    fprintf(stderr, "\t           mmap_threshold=N     requests of N bytes or more get their own mapping, 0 = never\n");
+    fprintf(stderr, "\t           trim_threshold=N     free gives a free tail of N bytes or more back, 0 = never\n");
+    fprintf(stderr, "\t           purge_threshold=N    free decommits the pages inside free blocks of N bytes or more, 0 = never\n");
+    fprintf(stderr, "\t           grow_max=N           the heap grows by chunks of up to N bytes beyond a request, 0 = exact\n");
+    fprintf(stderr, "\t           quick_budget=N       bytes of small freed blocks an arena keeps uncoalesced, 0 = none\n");
+    fprintf(stderr, "\t           layout=wide|compact  8-byte list pointers, or 4-byte links and 8-byte minimum blocks\n");
+    fprintf(stderr, "\t           fit_adapt=0|1        first fit everywhere, or a fit per size class picked at run time\n");
 }
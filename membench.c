@@ -0,0 +1,131 @@
+/*
+ * membench.c - measures mm_memcpy and mm_memset of memlib with each
+ * kernel the CPU supports, for sizes from 16 bytes to 64 MB.
+ *
+ * The buffers are mappings of the emulated heap.  Both start 16 bytes
+ * past a boundary, like block payloads, and half a page apart.  Each
+ * result is checked against the C library before it is timed.
+ *
+ * usage: membench [-c] [-s]   (-c: memcpy only, -s: memset only)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "fcyc.h"
+
+#define MIN_SIZE  16
+#define MAX_SIZE  (64 << 20)
+#define DST_SKEW  16                    /* payloads are 16-byte aligned */
+#define SRC_SKEW  2064                  /* half a page from the destination, so loads do not alias stores */
+
+static const char *level_names[] = { "scalar", "sse2", "avx2" };
+
+typedef struct {
+    unsigned char *dst;
+    unsigned char *src;
+    size_t size;
+} bench_t;
+
+static void run_copy(void *arg)
+{
+    bench_t *b = arg;
+    mm_memcpy(b->dst, b->src, b->size);
+}
+
+static void run_set(void *arg)
+{
+    bench_t *b = arg;
+    mm_memset(b->dst, 0x5a, b->size);
+}
+
+/*
+ * check - run the kernel once and compare with the C library; the bytes
+ *         around the destination must be left alone
+ */
+static bool check(bench_t *b, bool copy)
+{
+    memset(b->dst - DST_SKEW, 0xee, b->size + 2 * DST_SKEW);
+    if (copy)
+        run_copy(b);
+    else
+        run_set(b);
+    for (size_t i = 0; i < b->size; i++) {
+        if (b->dst[i] != (copy ? b->src[i] : 0x5a))
+            return false;
+    }
+    for (size_t i = 1; i <= DST_SKEW; i++) {
+        if (b->dst[-(long)i] != 0xee || b->dst[b->size + i - 1] != 0xee)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    bool do_copy = true, do_set = true;
+    int c;
+    while ((c = getopt(argc, argv, "cs")) != EOF) {
+        switch (c) {
+        case 'c':
+            do_set = false;
+            break;
+        case 's':
+            do_copy = false;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c] [-s]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    mem_init();
+    int best = mem_use_simd(MEM_SIMD_AVX2);
+    bench_t b;
+    unsigned char *src_map = mm_mmap(MAX_SIZE + SRC_SKEW);
+    unsigned char *dst_map = mm_mmap(MAX_SIZE + 2 * DST_SKEW);
+    if (src_map == (void *) -1 || dst_map == (void *) -1) {
+        fprintf(stderr, "mm_mmap failed\n");
+        exit(1);
+    }
+    b.src = src_map + SRC_SKEW;
+    b.dst = dst_map + DST_SKEW;
+    for (size_t i = 0; i < MAX_SIZE; i++)
+        b.src[i] = (unsigned char)(i * 131 + 7);
+
+    printf("%12s", "bytes");
+    for (int op = 0; op < 2; op++) {
+        if (!(op == 0 ? do_copy : do_set))
+            continue;
+        for (int level = MEM_SIMD_NONE; level <= best; level++)
+            printf("  %4s-%-6s", op == 0 ? "cpy" : "set", level_names[level]);
+    }
+    printf("   (GB/s)\n");
+
+    for (size_t size = MIN_SIZE; size <= MAX_SIZE; size *= 4) {
+        b.size = size;
+        printf("%12zu", size);
+        for (int op = 0; op < 2; op++) {
+            if (!(op == 0 ? do_copy : do_set))
+                continue;
+            for (int level = MEM_SIMD_NONE; level <= best; level++) {
+                mem_use_simd(level);
+                if (!check(&b, op == 0)) {
+                    printf("\n%s with %s is wrong at %zu bytes\n",
+                           op == 0 ? "mm_memcpy" : "mm_memset", level_names[level], size);
+                    exit(1);
+                }
+                double secs = fsec(op == 0 ? run_copy : run_set, &b);
+                printf("  %11.2f", size / secs / 1e9);
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    mem_use_simd(best);
+    mem_deinit();
+    return 0;
+}
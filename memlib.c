@@ -4,6 +4,7 @@
  * package with the system's malloc package in libc.
  *
  */
+#define _GNU_SOURCE                         /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,27 +15,100 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MEM_X86 1
+#endif
 
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * The reserved area is split in two halves.  The main heap grows from the
+ * bottom of the lower half, the upper half is cut into regions of
+ * MEM_REGION_SIZE bytes; region i-1 belongs to arena i.  The regions after
+ * the last arena form the mapping zone that mm_mmap hands out pages from.
+ */
+#define MEM_MAIN_SIZE   (MAX_HEAP_SIZE / 2)
+#define MEM_REGION_SIZE (MAX_HEAP_SIZE / 32)
+#define MEM_MAP_OFFSET  (MEM_MAIN_SIZE + (MEM_MAX_ARENAS - 1) * MEM_REGION_SIZE)
+
+/*
+ * Copies and clears of at least this many bytes use non-temporal stores:
+ * they would push more than they are worth out of the cache
+ */
+#define MEM_NT_THRESHOLD (1 << 20)
+
+/* A live mapping of the mapping zone */
+typedef struct {
+    unsigned char *lo;
+    size_t size;
+} mapping_t;
+
 /* private global variables */
 static unsigned char *heap;                 /* Starting address of heap */
 static unsigned char *mem_brk;              /* Current position of break */
 static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
+static unsigned char *arena_brk[MEM_MAX_ARENAS];  /* Break of each arena, [0] is unused */
+static unsigned char *arena_fresh[MEM_MAX_ARENAS];  /* Bytes of each arena from here on read as zero, [0] is the main heap */
+static mapping_t *mappings;                 /* Live mappings, sorted by address */
+static size_t num_mappings;
+static size_t max_mappings;                 /* Capacity of mappings */
+static size_t mapped_bytes;                 /* Total size of the live mappings */
+static size_t sbrk_calls;                   /* Calls to mm_sbrk and mm_arena_sbrk since the last reset */
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;  /* Guards the mapping table */
+
+/*
+ * page_up - the first page boundary of the reserved area at or above p
+ */
+static unsigned char *page_up(const unsigned char *p) {
+    size_t page = mem_pagesize();
+    return heap + ((size_t)(p - heap) + page - 1) / page * page;
+}
+
+/*
+ * release_pages - give the whole pages inside [lo, hi) back to the system
+ *                 and return how many bytes that is.  They read as zero
+ *                 when they are touched again.
+ */
+static size_t release_pages(unsigned char *lo, unsigned char *hi) {
+    size_t page = mem_pagesize();
+    unsigned char *first = page_up(lo);
+    unsigned char *last = heap + (size_t)(hi - heap) / page * page;
+    if (first >= last)
+	return 0;
+    madvise(first, last - first, MADV_DONTNEED);
+    return last - first;
+}
+
+/*
+ * note_brk - the break of an arena moved from old_brk to new_brk: the
+ *            bytes below a higher break may be written from now on,
+ *            the pages above a lower one were released
+ */
+static void note_brk(int arena, unsigned char *old_brk, unsigned char *new_brk) {
+    if (new_brk > arena_fresh[arena])
+	arena_fresh[arena] = new_brk;
+    else if (new_brk < old_brk && arena_fresh[arena] <= page_up(old_brk))
+	arena_fresh[arena] = page_up(new_brk);
+}
 
 /* 
  * mm_sbrk - simple model of the sbrk function. Extends the heap 
  *           by incr bytes and returns the start address of the
- *           new area. In this model, the heap cannot be shrunk.
+ *           new area. A negative incr shrinks the heap again, as
+ *           long as the break stays at or above its start.
  */
 void *mm_sbrk(intptr_t incr) {
     unsigned char *old_brk = mem_brk;
 
+    __atomic_fetch_add(&sbrk_calls, 1, __ATOMIC_RELAXED);
+
     bool ok = true;
-    if (incr < 0) {
+    if (incr < 0 && (size_t) -incr > (size_t)(mem_brk - heap)) {
 	ok = false;
-	fprintf(stderr, "ERROR: mm_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
+	fprintf(stderr, "ERROR: mm_sbrk failed.  Attempt to shrink heap by %ld bytes below its start\n", (long) incr);
     } else if (mem_brk + incr > mem_max_addr) {
 	ok = false;
 	long alloc = mem_brk - heap + incr;
@@ -42,6 +116,9 @@ void *mm_sbrk(intptr_t incr) {
     }
     if (ok) {
 	mem_brk += incr;
+	note_brk(0, old_brk, mem_brk);
+	if (incr < 0)
+	    release_pages(mem_brk, page_up(old_brk));  /* like the kernel when the break goes down */
 	return (void *) old_brk;
     } else {
 	errno = ENOMEM;
@@ -70,6 +147,277 @@ size_t mm_heapsize() {
     return (size_t)(mem_brk - heap);
 }
 
+/*
+ * arena_base - first byte of the region of an arena
+ */
+static unsigned char *arena_base(int arena) {
+    return heap + MEM_MAIN_SIZE + (size_t)(arena - 1) * MEM_REGION_SIZE;
+}
+
+/*
+ * mm_arena_sbrk - extends (or with a negative incr, shrinks) an arena by
+ *                 incr bytes and returns the old break.  Arena 0 is the
+ *                 main heap.
+ */
+void *mm_arena_sbrk(int arena, intptr_t incr) {
+    assert(arena >= 0 && arena < MEM_MAX_ARENAS);
+    if (arena == 0)
+	return mm_sbrk(incr);
+
+    unsigned char *old_brk = arena_brk[arena];
+    __atomic_fetch_add(&sbrk_calls, 1, __ATOMIC_RELAXED);
+    if (incr < 0 && (size_t) -incr > (size_t)(old_brk - arena_base(arena))) {
+	fprintf(stderr, "ERROR: mm_arena_sbrk failed.  Attempt to shrink arena %d by %ld bytes below its start\n", arena, (long) incr);
+    } else if (old_brk + incr > arena_base(arena) + MEM_REGION_SIZE) {
+	fprintf(stderr, "ERROR: mm_arena_sbrk failed. Ran out of memory in arena %d\n", arena);
+    } else {
+	arena_brk[arena] += incr;
+	note_brk(arena, old_brk, arena_brk[arena]);
+	if (incr < 0)
+	    release_pages(arena_brk[arena], page_up(old_brk));
+	return (void *) old_brk;
+    }
+    errno = ENOMEM;
+    return (void *) -1;
+}
+
+/*
+ * mm_arena_lo - return address of the first byte of an arena
+ */
+void *mm_arena_lo(int arena) {
+    return arena == 0 ? (void *) heap : (void *) arena_base(arena);
+}
+
+/*
+ * mm_arena_hi - return address of the last byte of an arena
+ */
+void *mm_arena_hi(int arena) {
+    return arena == 0 ? (void *)(mem_brk - 1) : (void *)(arena_brk[arena] - 1);
+}
+
+/*
+ * mm_arena_size - returns the size of an arena in bytes
+ */
+size_t mm_arena_size(int arena) {
+    return arena == 0 ? mm_heapsize() : (size_t)(arena_brk[arena] - arena_base(arena));
+}
+
+/*
+ * mm_arena_fresh - returns the address from which the bytes of an arena
+ *                  read as zero: they were not handed out by a break
+ *                  since their pages were last released.  Like the
+ *                  kernel, sbrk gives fresh memory, but the driver
+ *                  resets the break without releasing the pages.
+ */
+void *mm_arena_fresh(int arena) {
+    return (void *) arena_fresh[arena];
+}
+
+/*
+ * mm_arena_of - returns the arena whose region holds ptr, -1 if none does
+ */
+int mm_arena_of(const void *ptr) {
+    const unsigned char *p = ptr;
+    if (p < heap || p >= heap + MAX_HEAP_SIZE)
+	return -1;
+    if (p < heap + MEM_MAIN_SIZE)
+	return 0;
+    size_t region = (size_t)(p - heap - MEM_MAIN_SIZE) / MEM_REGION_SIZE;
+    return region + 1 < MEM_MAX_ARENAS ? (int) region + 1 : -1;
+}
+
+/*
+ * mm_arena_reset - make an arena empty again.  The main heap is reset
+ *                  by the driver with mem_reset_brk.
+ */
+void mm_arena_reset(int arena) {
+    assert(arena > 0 && arena < MEM_MAX_ARENAS);
+    arena_brk[arena] = arena_base(arena);
+}
+
+/*
+ * find_gap - first fit over the gaps between the sorted mappings: the
+ *            lowest address of the mapping zone with length free bytes
+ *            above it.  *index is where a mapping there goes in the table
+ */
+static unsigned char *find_gap(size_t length, size_t *index) {
+    unsigned char *lo = heap + MEM_MAP_OFFSET;
+    size_t i;
+    for (i = 0; i < num_mappings; i++) {
+	if ((size_t)(mappings[i].lo - lo) >= length)
+	    break;
+	lo = mappings[i].lo + mappings[i].size;
+    }
+    *index = i;
+    return lo;
+}
+
+/*
+ * mm_mmap - simple model of an anonymous mmap.  Maps length bytes (rounded
+ *           up to whole pages) at the lowest free address of the mapping
+ *           zone and returns it, or (void *) -1 if there is no room.  The
+ *           pages read as zero, like fresh pages from the kernel.
+ */
+void *mm_mmap(size_t length) {
+    size_t page = mem_pagesize();
+    unsigned char *lo;
+    size_t i;
+
+    if (length == 0 || length > MAX_HEAP_SIZE - MEM_MAP_OFFSET) {
+	errno = EINVAL;
+	return (void *) -1;
+    }
+    length = (length + page - 1) / page * page;
+    pthread_mutex_lock(&map_lock);
+    lo = find_gap(length, &i);
+    if (lo + length > heap + MAX_HEAP_SIZE) {
+	pthread_mutex_unlock(&map_lock);
+	fprintf(stderr, "ERROR: mm_mmap failed. Ran out of memory.  Could not map %zu (0x%zx) bytes\n", length, length);
+	errno = ENOMEM;
+	return (void *) -1;
+    }
+    if (num_mappings == max_mappings) {
+	size_t max = max_mappings ? 2 * max_mappings : 64;
+	mapping_t *table = realloc(mappings, max * sizeof(mapping_t));
+	if (table == NULL) {
+	    pthread_mutex_unlock(&map_lock);
+	    errno = ENOMEM;
+	    return (void *) -1;
+	}
+	mappings = table;
+	max_mappings = max;
+    }
+    memmove(&mappings[i + 1], &mappings[i], (num_mappings - i) * sizeof(mapping_t));
+    mappings[i].lo = lo;
+    mappings[i].size = length;
+    num_mappings++;
+    mapped_bytes += length;
+    pthread_mutex_unlock(&map_lock);
+    return (void *) lo;
+}
+
+/*
+ * find_mapping - index of the mapping that holds ptr, or of the first
+ *                mapping above it if none does.  Called with map_lock held.
+ */
+static size_t find_mapping(const unsigned char *ptr) {
+    size_t lo = 0, hi = num_mappings;
+    while (lo < hi) {
+	size_t mid = (lo + hi) / 2;
+	if (mappings[mid].lo + mappings[mid].size <= ptr)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * mm_munmap - removes a whole mapping made by mm_mmap.  addr must be its
+ *             start and length its (unrounded or rounded) length.  The
+ *             pages are given back to the system.  Returns 0 on success,
+ *             -1 if there is no such mapping.
+ */
+int mm_munmap(void *addr, size_t length) {
+    size_t page = mem_pagesize();
+    size_t i;
+
+    length = (length + page - 1) / page * page;
+    pthread_mutex_lock(&map_lock);
+    i = find_mapping(addr);
+    if (i == num_mappings || mappings[i].lo != addr || mappings[i].size != length) {
+	pthread_mutex_unlock(&map_lock);
+	fprintf(stderr, "ERROR: mm_munmap failed.  %p:%zu is not a mapping\n", addr, length);
+	errno = EINVAL;
+	return -1;
+    }
+    madvise(addr, length, MADV_DONTNEED);
+    memmove(&mappings[i], &mappings[i + 1], (num_mappings - i - 1) * sizeof(mapping_t));
+    num_mappings--;
+    mapped_bytes -= length;
+    pthread_mutex_unlock(&map_lock);
+    return 0;
+}
+
+/*
+ * mm_mremap - simple model of mremap with MREMAP_MAYMOVE: resizes the
+ *             whole mapping at addr from old_length to new_length bytes
+ *             (both rounded up to whole pages).  A mapping shrinks or
+ *             grows in place if the addresses above it are free, else
+ *             its pages are moved by the kernel to the lowest gap that
+ *             fits, without copying them.  The new pages read as zero.
+ *             Returns the address of the mapping, or (void *) -1.
+ */
+void *mm_mremap(void *addr, size_t old_length, size_t new_length) {
+    size_t page = mem_pagesize();
+    unsigned char *old_lo = addr;
+    unsigned char *limit, *lo;
+    size_t i, j;
+
+    if (new_length == 0 || new_length > MAX_HEAP_SIZE - MEM_MAP_OFFSET) {
+	errno = EINVAL;
+	return (void *) -1;
+    }
+    old_length = (old_length + page - 1) / page * page;
+    new_length = (new_length + page - 1) / page * page;
+    pthread_mutex_lock(&map_lock);
+    i = find_mapping(addr);
+    if (i == num_mappings || mappings[i].lo != addr || mappings[i].size != old_length) {
+	pthread_mutex_unlock(&map_lock);
+	fprintf(stderr, "ERROR: mm_mremap failed.  %p:%zu is not a mapping\n", addr, old_length);
+	errno = EINVAL;
+	return (void *) -1;
+    }
+    limit = i + 1 < num_mappings ? mappings[i + 1].lo : heap + MAX_HEAP_SIZE;
+    if (new_length <= old_length || old_lo + new_length <= limit) {
+	if (new_length < old_length)
+	    madvise(old_lo + new_length, old_length - new_length, MADV_DONTNEED);
+	mappings[i].size = new_length;
+	mapped_bytes += new_length - old_length;
+	pthread_mutex_unlock(&map_lock);
+	return addr;
+    }
+    lo = find_gap(new_length, &j);
+    if (lo + new_length > heap + MAX_HEAP_SIZE ||
+	mremap(old_lo, old_length, new_length, MREMAP_MAYMOVE | MREMAP_FIXED, lo) == MAP_FAILED) {
+	pthread_mutex_unlock(&map_lock);
+	errno = ENOMEM;
+	return (void *) -1;
+    }
+    /* the old pages left a hole in the reserved area, fill it again */
+    if (mmap(old_lo, old_length, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+	fprintf(stderr, "FAILURE.  mmap couldn't fill the hole mm_mremap left\n");
+	exit(1);
+    }
+    /* the gap is below or above the old place in the sorted table */
+    if (j <= i) {
+	memmove(&mappings[j + 1], &mappings[j], (i - j) * sizeof(mapping_t));
+    } else {
+	memmove(&mappings[i], &mappings[i + 1], (j - i - 1) * sizeof(mapping_t));
+	j--;
+    }
+    mappings[j].lo = lo;
+    mappings[j].size = new_length;
+    mapped_bytes += new_length - old_length;
+    pthread_mutex_unlock(&map_lock);
+    return (void *) lo;
+}
+
+/*
+ * mm_purge - simple model of madvise(MADV_DONTNEED): decommits the whole
+ *            pages inside [addr, addr + length) and returns how many bytes
+ *            that is.  The bytes around them, e.g. the header and footer
+ *            of a free block, are left alone.  A purged page reads as zero
+ *            when it is touched again.
+ */
+size_t mm_purge(void *addr, size_t length) {
+    unsigned char *lo = addr;
+    if (lo < heap || lo + length > heap + MAX_HEAP_SIZE)
+	return 0;
+    return release_pages(lo, lo + length);
+}
+
 /*
  * mm_pagesize - returns the page size of the system
  */
@@ -78,9 +426,10 @@ size_t mm_pagesize(){
 }
 
 /*
- * mm_memcpy - copies n bytes from src to dst
+ * copy_words - the scalar mm_memcpy: 8 bytes at a time through
+ *              mem_read and mem_write
  */
-void *mm_memcpy(void *dst, const void *src, size_t n) {
+static void *copy_words(void *dst, const void *src, size_t n) {
     void *savedst = dst;
     size_t w = sizeof(uint64_t);
     while (n >= w) {
@@ -98,9 +447,34 @@ void *mm_memcpy(void *dst, const void *src, size_t n) {
 }
 
 /*
- * mm_memset - sets the first n bytes of memory pointed to by dst to c
+ * mm_memmove - copies n bytes from src to dst, which may overlap.  The
+ *              words are copied from the end when dst is above src, so
+ *              no byte is overwritten before it has been read.
  */
-void *mm_memset(void *dst, int c, size_t n) {
+void *mm_memmove(void *dst, const void *src, size_t n) {
+    size_t w = sizeof(uint64_t);
+    if ((unsigned char *) dst <= (const unsigned char *) src
+	|| (unsigned char *) dst >= (const unsigned char *) src + n)
+	return mm_memcpy(dst, src, n);
+    /* the tail first, then whole words downwards */
+    size_t tail = n % w;
+    if (tail) {
+	n -= tail;
+	uint64_t data = mem_read((const unsigned char *) src + n, tail);
+	mem_write((unsigned char *) dst + n, data, tail);
+    }
+    while (n >= w) {
+	n -= w;
+	uint64_t data = mem_read((const unsigned char *) src + n, w);
+	mem_write((unsigned char *) dst + n, data, w);
+    }
+    return dst;
+}
+
+/*
+ * set_words - the scalar mm_memset: 8 bytes at a time through mem_write
+ */
+static void *set_words(void *dst, int c, size_t n) {
     void *savedst = dst;
     uint64_t byte = c & 0xFF;
     uint64_t data = 0;
@@ -120,12 +494,230 @@ void *mm_memset(void *dst, int c, size_t n) {
     return savedst;
 }
 
+#ifdef MEM_X86
+/*
+ * The vector kernels read and write the heap directly, as mem_read and
+ * mem_write do in this dense emulation.  Each stores the first and last
+ * vector unaligned (they may overlap the rest) and everything between
+ * with aligned stores, non-temporal ones for large sizes.
+ */
+
+/*
+ * copy_sse2 - mm_memcpy with 16-byte SSE2 loads and stores
+ */
+static void *copy_sse2(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    if (n < 16)
+	return copy_words(dst, src, n);
+    __m128i head = _mm_loadu_si128((const __m128i *) s);
+    __m128i tail = _mm_loadu_si128((const __m128i *) (s + n - 16));
+    size_t skip = 16 - ((uintptr_t) d & 15);
+    unsigned char *p = d + skip;
+    const unsigned char *q = s + skip;
+    size_t left = n - skip;
+    if (left >= MEM_NT_THRESHOLD) {
+	for (; left >= 64; left -= 64, p += 64, q += 64) {
+	    __m128i a = _mm_loadu_si128((const __m128i *) q);
+	    __m128i b = _mm_loadu_si128((const __m128i *) (q + 16));
+	    __m128i c = _mm_loadu_si128((const __m128i *) (q + 32));
+	    __m128i e = _mm_loadu_si128((const __m128i *) (q + 48));
+	    _mm_stream_si128((__m128i *) p, a);
+	    _mm_stream_si128((__m128i *) (p + 16), b);
+	    _mm_stream_si128((__m128i *) (p + 32), c);
+	    _mm_stream_si128((__m128i *) (p + 48), e);
+	}
+	_mm_sfence();
+    }
+    for (; left >= 64; left -= 64, p += 64, q += 64) {
+	__m128i a = _mm_loadu_si128((const __m128i *) q);
+	__m128i b = _mm_loadu_si128((const __m128i *) (q + 16));
+	__m128i c = _mm_loadu_si128((const __m128i *) (q + 32));
+	__m128i e = _mm_loadu_si128((const __m128i *) (q + 48));
+	_mm_store_si128((__m128i *) p, a);
+	_mm_store_si128((__m128i *) (p + 16), b);
+	_mm_store_si128((__m128i *) (p + 32), c);
+	_mm_store_si128((__m128i *) (p + 48), e);
+    }
+    for (; left >= 16; left -= 16, p += 16, q += 16)
+	_mm_store_si128((__m128i *) p, _mm_loadu_si128((const __m128i *) q));
+    _mm_storeu_si128((__m128i *) d, head);
+    _mm_storeu_si128((__m128i *) (d + n - 16), tail);
+    return dst;
+}
+
+/*
+ * set_sse2 - mm_memset with 16-byte SSE2 stores
+ */
+static void *set_sse2(void *dst, int c, size_t n) {
+    unsigned char *d = dst;
+    if (n < 16)
+	return set_words(dst, c, n);
+    __m128i v = _mm_set1_epi8((char) c);
+    _mm_storeu_si128((__m128i *) d, v);
+    _mm_storeu_si128((__m128i *) (d + n - 16), v);
+    size_t skip = 16 - ((uintptr_t) d & 15);
+    unsigned char *p = d + skip;
+    size_t left = n - skip;
+    if (left >= MEM_NT_THRESHOLD) {
+	for (; left >= 64; left -= 64, p += 64) {
+	    _mm_stream_si128((__m128i *) p, v);
+	    _mm_stream_si128((__m128i *) (p + 16), v);
+	    _mm_stream_si128((__m128i *) (p + 32), v);
+	    _mm_stream_si128((__m128i *) (p + 48), v);
+	}
+	_mm_sfence();
+    }
+    for (; left >= 64; left -= 64, p += 64) {
+	_mm_store_si128((__m128i *) p, v);
+	_mm_store_si128((__m128i *) (p + 16), v);
+	_mm_store_si128((__m128i *) (p + 32), v);
+	_mm_store_si128((__m128i *) (p + 48), v);
+    }
+    for (; left >= 16; left -= 16, p += 16)
+	_mm_store_si128((__m128i *) p, v);
+    return dst;
+}
+
+/*
+ * copy_avx2 - mm_memcpy with 32-byte AVX2 loads and stores
+ */
+__attribute__((target("avx2")))
+static void *copy_avx2(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    if (n < 32)
+	return copy_sse2(dst, src, n);
+    __m256i head = _mm256_loadu_si256((const __m256i *) s);
+    __m256i tail = _mm256_loadu_si256((const __m256i *) (s + n - 32));
+    size_t skip = 32 - ((uintptr_t) d & 31);
+    unsigned char *p = d + skip;
+    const unsigned char *q = s + skip;
+    size_t left = n - skip;
+    if (left >= MEM_NT_THRESHOLD) {
+	for (; left >= 128; left -= 128, p += 128, q += 128) {
+	    __m256i a = _mm256_loadu_si256((const __m256i *) q);
+	    __m256i b = _mm256_loadu_si256((const __m256i *) (q + 32));
+	    __m256i c = _mm256_loadu_si256((const __m256i *) (q + 64));
+	    __m256i e = _mm256_loadu_si256((const __m256i *) (q + 96));
+	    _mm256_stream_si256((__m256i *) p, a);
+	    _mm256_stream_si256((__m256i *) (p + 32), b);
+	    _mm256_stream_si256((__m256i *) (p + 64), c);
+	    _mm256_stream_si256((__m256i *) (p + 96), e);
+	}
+	_mm_sfence();
+    }
+    for (; left >= 128; left -= 128, p += 128, q += 128) {
+	__m256i a = _mm256_loadu_si256((const __m256i *) q);
+	__m256i b = _mm256_loadu_si256((const __m256i *) (q + 32));
+	__m256i c = _mm256_loadu_si256((const __m256i *) (q + 64));
+	__m256i e = _mm256_loadu_si256((const __m256i *) (q + 96));
+	_mm256_store_si256((__m256i *) p, a);
+	_mm256_store_si256((__m256i *) (p + 32), b);
+	_mm256_store_si256((__m256i *) (p + 64), c);
+	_mm256_store_si256((__m256i *) (p + 96), e);
+    }
+    for (; left >= 32; left -= 32, p += 32, q += 32)
+	_mm256_store_si256((__m256i *) p, _mm256_loadu_si256((const __m256i *) q));
+    _mm256_storeu_si256((__m256i *) d, head);
+    _mm256_storeu_si256((__m256i *) (d + n - 32), tail);
+    return dst;
+}
+
+/*
+ * set_avx2 - mm_memset with 32-byte AVX2 stores
+ */
+__attribute__((target("avx2")))
+static void *set_avx2(void *dst, int c, size_t n) {
+    unsigned char *d = dst;
+    if (n < 32)
+	return set_sse2(dst, c, n);
+    __m256i v = _mm256_set1_epi8((char) c);
+    _mm256_storeu_si256((__m256i *) d, v);
+    _mm256_storeu_si256((__m256i *) (d + n - 32), v);
+    size_t skip = 32 - ((uintptr_t) d & 31);
+    unsigned char *p = d + skip;
+    size_t left = n - skip;
+    if (left >= MEM_NT_THRESHOLD) {
+	for (; left >= 128; left -= 128, p += 128) {
+	    _mm256_stream_si256((__m256i *) p, v);
+	    _mm256_stream_si256((__m256i *) (p + 32), v);
+	    _mm256_stream_si256((__m256i *) (p + 64), v);
+	    _mm256_stream_si256((__m256i *) (p + 96), v);
+	}
+	_mm_sfence();
+    }
+    for (; left >= 128; left -= 128, p += 128) {
+	_mm256_store_si256((__m256i *) p, v);
+	_mm256_store_si256((__m256i *) (p + 32), v);
+	_mm256_store_si256((__m256i *) (p + 64), v);
+	_mm256_store_si256((__m256i *) (p + 96), v);
+    }
+    for (; left >= 32; left -= 32, p += 32)
+	_mm256_store_si256((__m256i *) p, v);
+    return dst;
+}
+#endif
+
+/* The kernels mm_memcpy and mm_memset use, picked by mem_use_simd */
+static void *(*copy_kernel)(void *, const void *, size_t) = copy_words;
+static void *(*set_kernel)(void *, int, size_t) = set_words;
+
+/*
+ * mem_use_simd - use the widest kernels up to level that the CPU
+ *                supports, and return the level that is used
+ */
+int mem_use_simd(int level) {
+    int best = MEM_SIMD_NONE;
+#ifdef MEM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+	best = MEM_SIMD_SSE2;
+    if (__builtin_cpu_supports("avx2"))
+	best = MEM_SIMD_AVX2;
+#endif
+    if (level > best)
+	level = best;
+    switch (level) {
+#ifdef MEM_X86
+    case MEM_SIMD_AVX2:
+	copy_kernel = copy_avx2;
+	set_kernel = set_avx2;
+	break;
+    case MEM_SIMD_SSE2:
+	copy_kernel = copy_sse2;
+	set_kernel = set_sse2;
+	break;
+#endif
+    default:
+	level = MEM_SIMD_NONE;
+	copy_kernel = copy_words;
+	set_kernel = set_words;
+    }
+    return level;
+}
+
+/*
+ * mm_memcpy - copies n bytes from src to dst
+ */
+void *mm_memcpy(void *dst, const void *src, size_t n) {
+    return copy_kernel(dst, src, n);
+}
+
+/*
+ * mm_memset - sets the first n bytes of memory pointed to by dst to c
+ */
+void *mm_memset(void *dst, int c, size_t n) {
+    return set_kernel(dst, c, n);
+}
+
 /*************** Memory emulation  *******************/
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(){
+    int arena;
     unsigned char* addr = mmap(NULL,                                        /* start*/
                                MAX_HEAP_SIZE,                               /* length */
                                PROT_READ | PROT_WRITE,                      /* permissions */
@@ -137,7 +729,11 @@ void mem_init(){
 	exit(1);
     }
     heap = addr;
-    mem_max_addr = addr + MAX_HEAP_SIZE;
+    mem_max_addr = addr + MEM_MAIN_SIZE;
+    mem_use_simd(MEM_SIMD_AVX2);
+    arena_fresh[0] = heap;
+    for (arena = 1; arena < MEM_MAX_ARENAS; arena++)
+	arena_fresh[arena] = arena_base(arena);
     mem_reset_brk();
 }
 
@@ -155,7 +751,17 @@ void mem_deinit(void){
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk(){
+    int arena;
+    size_t i;
     mem_brk = heap;
+    for (arena = 1; arena < MEM_MAX_ARENAS; arena++)
+	mm_arena_reset(arena);
+    /* drop the mappings of the previous run */
+    for (i = 0; i < num_mappings; i++)
+	madvise(mappings[i].lo, mappings[i].size, MADV_DONTNEED);
+    num_mappings = 0;
+    mapped_bytes = 0;
+    sbrk_calls = 0;
 }
 
 void *mem_sbrk(intptr_t incr) {
@@ -178,6 +784,95 @@ size_t mem_pagesize(){
     return (size_t) getpagesize();
 }
 
+/*
+ * resident_pages - number of pages of [lo, hi) that are in memory
+ */
+static size_t resident_pages(unsigned char *lo, unsigned char *hi) {
+    size_t page = mem_pagesize();
+    unsigned char vec[4096];
+    size_t count = 0;
+    size_t i, n;
+    lo = heap + (size_t)(lo - heap) / page * page;
+    while (lo < hi) {
+	n = (size_t)(hi - lo + page - 1) / page;
+	if (n > sizeof(vec))
+	    n = sizeof(vec);
+	if (mincore(lo, n * page, vec) != 0)
+	    return count;
+	for (i = 0; i < n; i++)
+	    count += vec[i] & 1;
+	lo += n * page;
+    }
+    return count;
+}
+
+/*
+ * mem_resident_pages - number of pages of the heaps and mappings in use
+ *                      that are in memory (mincore)
+ */
+size_t mem_resident_pages(void) {
+    int arena;
+    size_t i, count;
+    count = resident_pages(heap, mem_brk);
+    for (arena = 1; arena < MEM_MAX_ARENAS; arena++)
+	count += resident_pages(arena_base(arena), arena_brk[arena]);
+    pthread_mutex_lock(&map_lock);
+    for (i = 0; i < num_mappings; i++)
+	count += resident_pages(mappings[i].lo, mappings[i].lo + mappings[i].size);
+    pthread_mutex_unlock(&map_lock);
+    return count;
+}
+
+/*
+ * mem_release - decommit every page the heaps and mappings use now, so a
+ *               run that follows mem_reset_brk starts with nothing resident
+ */
+void mem_release(void) {
+    int arena;
+    size_t i;
+    release_pages(heap, page_up(mem_brk));
+    if (arena_fresh[0] <= page_up(mem_brk))
+	arena_fresh[0] = heap;
+    for (arena = 1; arena < MEM_MAX_ARENAS; arena++) {
+	release_pages(arena_base(arena), page_up(arena_brk[arena]));
+	if (arena_fresh[arena] <= page_up(arena_brk[arena]))
+	    arena_fresh[arena] = arena_base(arena);
+    }
+    pthread_mutex_lock(&map_lock);
+    for (i = 0; i < num_mappings; i++)
+	release_pages(mappings[i].lo, mappings[i].lo + mappings[i].size);
+    pthread_mutex_unlock(&map_lock);
+}
+
+/*
+ * mem_mapped_size - total size of the live mm_mmap mappings in bytes
+ */
+size_t mem_mapped_size(void) {
+    return mapped_bytes;
+}
+
+/*
+ * mem_sbrk_calls - calls to mm_sbrk and mm_arena_sbrk since the last
+ *                  mem_reset_brk, shrinking ones included
+ */
+size_t mem_sbrk_calls(void) {
+    return sbrk_calls;
+}
+
+/*
+ * mem_in_mapping - true if [lo, hi] lies within a single live mapping
+ */
+bool mem_in_mapping(const void *lo, const void *hi) {
+    bool in;
+    size_t i;
+    pthread_mutex_lock(&map_lock);
+    i = find_mapping(lo);
+    in = i < num_mappings && mappings[i].lo <= (const unsigned char *) lo &&
+	(const unsigned char *) hi < mappings[i].lo + mappings[i].size;
+    pthread_mutex_unlock(&map_lock);
+    return in;
+}
+
 /* Read len bytes and return value zero-extended to 64 bits */
 uint64_t mem_read(const void *addr, size_t len) {
     uint64_t rdata;
@@ -10,8 +10,39 @@ void *mm_heap_hi(void);
 size_t mm_heapsize(void);
 size_t mm_pagesize(void);
 void *mm_memcpy(void *dst, const void *src, size_t n);
+void *mm_memmove(void *dst, const void *src, size_t n);
 void *mm_memset(void *dst, int c, size_t n);
 
+/* Arenas: independent heaps, each growing in its own region of the
+ * reserved area.  Arena 0 is the main heap above (mm_sbrk); arenas
+ * 1 .. MEM_MAX_ARENAS-1 are for allocators that give threads their own heap.
+ * Each arena has its own break, so arenas can grow concurrently as long as
+ * every arena is only grown by one thread at a time. */
+#define MEM_MAX_ARENAS 8
+
+void *mm_arena_sbrk(int arena, intptr_t incr);
+void *mm_arena_lo(int arena);
+void *mm_arena_hi(int arena);
+size_t mm_arena_size(int arena);
+int mm_arena_of(const void *ptr);      /* arena whose region holds ptr, -1 if none */
+void *mm_arena_fresh(int arena);       /* the arena's bytes from here on read as zero */
+void mm_arena_reset(int arena);        /* make an arena empty again */
+
+/* Mappings: page-granular regions outside every arena, like anonymous
+ * mmap.  mm_mmap returns (void *) -1 on failure; mm_munmap must be given
+ * a whole mapping and returns 0 on success, -1 on error. */
+void *mm_mmap(size_t length);
+int mm_munmap(void *addr, size_t length);
+
+/* Resize a whole mapping, like mremap(MREMAP_MAYMOVE): in place if there
+ * is room, else its pages move without being copied.  Returns the mapping's
+ * (maybe new) address, or (void *) -1 on failure */
+void *mm_mremap(void *addr, size_t old_length, size_t new_length);
+
+/* Decommit the whole pages inside [addr, addr + length), like
+ * madvise(MADV_DONTNEED).  Returns the number of bytes decommitted */
+size_t mm_purge(void *addr, size_t length);
+
 /* Functions used for memory emulation */
 /* You should not be calling these functions */
 
@@ -23,6 +54,19 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_mapped_size(void);
+bool mem_in_mapping(const void *lo, const void *hi);
+size_t mem_resident_pages(void);
+void mem_release(void);
+size_t mem_sbrk_calls(void);
+
+/* Kernels of mm_memcpy and mm_memset.  mem_init picks the widest the CPU
+ * supports; mem_use_simd caps them at a level (e.g. to compare them) and
+ * returns the level in effect */
+#define MEM_SIMD_NONE 0    /* 8 bytes at a time through mem_read/mem_write */
+#define MEM_SIMD_SSE2 1
+#define MEM_SIMD_AVX2 2
+int mem_use_simd(int level);
 
 /* Read len bytes and return value zero-extended to 64 bits */
 /* Require 0 <= len <= 8 */
@@ -13,14 +13,19 @@
  ******************************************************************************************************************/
  
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "mm.h"
+#include "mm_inline.h"
+#include "mm_classes.h"
 #include "memlib.h"
 
 /*
@@ -51,41 +56,269 @@
 #define memcpy mm_memcpy
 #endif // DRIVER
 
+#ifdef DRIVER
+// the aligned allocators are tested by the driver as well
+#define aligned_alloc mm_aligned_alloc
+#define posix_memalign mm_posix_memalign
+#endif // DRIVER
+
 #define ALIGNMENT 16
 //#####################################
 // defining some constants
 #define headerORFooter_SIZE 8
 #define prev_SIZE 8
 #define next_SIZE 8
+#define LINK_PREV 0             // free-list links of a block, see get_link/set_link
+#define LINK_NEXT 1
+#define PREV_MIN 0x4            // header bit: the previous block is a minimum block (compact layout), it has no footer
+#define MIN_BLOCK_COMPACT 8     // smallest block size with the compact layout: two 4-byte links and no footer
+#define COMPACT_HEAP_MAX (1ull << 36) // a compact heap ends at most 64GB past its control block, as far as a link reaches
+#define ZERO_BIT 0x8            // header bit of a free block whose payload reads zero, apart from its links and footer
+#define ZERO_SKIP 24            // payload bytes of a free block that may hold list or tree links
+#define ZERO_MIN 32             // smallest free block marked zero, smaller ones are all links and footer
 #define BLK_NUM_INIT 4
 #define INIT_SIZE 32    //Padding(8) + Prologue(16) + Epilogue(8)
-#define NUM_FREE_LISTS 14
+#define NUM_FREE_LISTS CLASS_COUNT       // size classes of mm_classes.h, generated from a spec in classes/
+#define LARGE_TREE_CLASS (CLASS_COUNT - 1) // the last class is a size-ordered tree instead of a list (MM_POLICY_SEGLIST)
+#define TLSF_SL_LOG2 4          // every first-level TLSF class is split into 2^4 second-level lists
+#define TLSF_SL_COUNT 16
+#define TLSF_SMALL_LOG2 8       // sizes below 256 bytes share first level 0 and are split linearly
+#define TLSF_FL_COUNT 34        // first level k >= 1 holds sizes in [2^(k+7), 2^(k+8)), enough for MAX_HEAP_SIZE
+#define SLAB_PAGE_SIZE 4096     // a slab is one page-aligned page cut into equal headerless slots
+#define SLAB_NUM_CLASSES 4      // slot sizes 16, 32, 48 and 64
+#define SLAB_MAX_SIZE 64        // largest request a slab can serve
+#define SLAB_BLOCK_SIZE 4088    // a slab block stops 8 bytes short of the next page, which holds the next header
+#define SLAB_WARMUP 64          // requests of a class served from ordinary blocks before it gets its first slab
+#define PAGE_MAP_INIT_PAGES 4096    // the first page map covers 16MB of heap, it doubles when needed
+#define TCACHE_NUM_BINS 16      // blocks of size 24, 40, ..., 264 are cached per thread, one bin per size
+#define TCACHE_MIN_SIZE 24      // blocks of the compact layout's minimum size are not cached
+#define TCACHE_MAX_SIZE 264
+#define TCACHE_COUNT 7          // default number of blocks a bin holds
+#define TCACHE_MAX_COUNT 255
+#define MMAP_THRESHOLD (128 * 1024) // default: requests of 128KB and more get a mapping of their own
+#define TRIM_THRESHOLD (128 * 1024) // default: a free tail of 128KB and more is given back to memlib
+#define PURGE_THRESHOLD (1024 * 1024) // default: the pages inside a free block of 1MB and more are decommitted
+#define QUICK_BUDGET (64 * 1024) // default: up to 64KB of small freed blocks per arena wait in quick lists
+#define GROW_MAX (64 * 1024)    // default: the heap grows by chunks of up to 64KB beyond a request
+#define GROW_MIN 4096           // smallest chunk, a smaller one is not worth the unused tail
+#define GROW_WINDOW 256         // misses less than this many mallocs apart double the chunk, others halve it
+#define GROW_HEAP_SHARE 32      // a chunk is at most 1/32 of the heap, which bounds the unused tail
+#define MMAP_HEADER_SIZE 16     // a mapped payload follows a word with its offset in the mapping and a header
+#define FIT_WINDOW 128          // searches starting in a class between two reviews of its fit
+#define FIT_HYSTERESIS 3        // a class changes fit after this many reviews in a row ask for the same other one
+#define FIT_BEST_OF 8           // bounded best fit takes the best of up to this many blocks that fit
+#define FIT_ADDRESS_MAX 64      // a list is put in address order only if it holds at most this many blocks
+#define FIT_HEAP_MIN (256 * 1024) // a heap keeps fit statistics once it is this large, a smaller one stays first fit
+#define SPIN_MAX 128            // a waiter gives up its timeslice after this many looks at a held lock
 //#####################################
 
-void* free_lists[NUM_FREE_LISTS];
-void* last_block_start;
-int heap_size = 0;
+// MM_MALLOC of mm_inline.h folds constant requests to a cache bin with these sizes
+_Static_assert(ALIGNMENT == MM_ALIGNMENT && TCACHE_MIN_SIZE == MM_CACHE_MIN_BLOCK &&
+               TCACHE_MAX_SIZE == MM_CACHE_MAX_BLOCK && TCACHE_NUM_BINS == MM_CACHE_BINS,
+               "mm_inline.h does not round like mm.c");
+
+// TLSF index: one free list per (first level, second level) pair and a bitmap per level
+// that says which lists are non-empty, so a fit is found with two find-first-set operations.
+typedef struct {
+    uint64_t fl_bitmap;                           // bit fl is set if sl_bitmap[fl] != 0
+    uint32_t sl_bitmap[TLSF_FL_COUNT];            // bit sl is set if heads[fl][sl] != NULL
+    void* heads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+} tlsf_index_t;
+
+// A slab page starts with this header, the slots follow it. There is no header per slot:
+// free finds the slab by rounding the address down to the page, once the page map says it is a slab.
+typedef struct slab {
+    struct slab* next;      // slabs of the same class that have a free slot
+    struct slab* prev;
+    uint16_t slot_size;
+    uint16_t num_slots;
+    uint16_t num_free;
+    uint16_t unused;
+    uint64_t used[4];       // bit i is set if slot i is allocated
+} slab_t;
+
+// Per-thread cache of freed blocks, one LIFO list per block size, linked through the first
+// word of the payload. Its blocks are still allocated as far as their arena knows, so taking
+// one back out needs no lock. Slab slots are not cached: handing them out in LIFO order
+// instead of from the lowest slab keeps every slab partly full.
+typedef struct {
+    void* heads[TCACHE_NUM_BINS];
+    uint8_t counts[TCACHE_NUM_BINS];
+} tcache_t;
+
+// Per segregated list (MM_POLICY_SEGLIST): the fit its searches use and what the current
+// window saw, which fit_review turns into the fit of the next window. The reviews only
+// compare these counts, so steps and splits stop at their maximum and frees and merges are
+// halved together when frees reaches its own.
+typedef struct {
+    uint32_t length;            // blocks in the list
+    uint16_t steps;             // blocks the searches of this window looked at
+    uint16_t frees;             // blocks of this class freed, this window
+    uint16_t merges;            // of those, blocks freed next to a free block
+    uint16_t splits;            // blocks of this class taken and split, this window
+    uint8_t searches;           // searches that started in this class, this window (up to FIT_WINDOW)
+    uint8_t fit;                // MM_FIT_FIRST, MM_FIT_BEST_OF or MM_FIT_ADDRESS
+    uint8_t vote;               // the other fit the last reviews asked for
+    uint8_t streak;             // reviews in a row that asked for it
+} fit_class_t;
+
+// The control block sits at the start of the heap, below the prologue. The allocator state
+// lives here instead of in globals, which are limited to 128 bytes. It is paid for by every
+// heap, however small, so state a heap may never need (the page map, the quick lists and
+// the fit statistics) is allocated from the heap on first use and only a pointer stays here.
+// Every arena (memlib region) has its own heap and control block; the one of the main heap
+// (arena 0) also decides which arena a new thread gets.
+typedef struct {
+    void* free_lists[NUM_FREE_LISTS];   // segregated list heads, tree root for the last class (MM_POLICY_SEGLIST)
+    void* heap_start;                   // header of the first block after the prologue
+    slab_t* slabs[SLAB_NUM_CLASSES];    // per slot size, the slabs that still have a free slot
+    uint8_t* page_map;                  // one bit per heap page, set if the page is a slab, NULL until the first slab
+    void* remote_frees;                 // blocks freed by threads of other arenas, a lock-free stack
+                                        // linked through the payload, emptied by the next lock holder
+    void** quick;                       // per size, freed blocks linked through the payload, still marked
+                                        // allocated, so they are not coalesced until the lists are consolidated.
+                                        // NULL until the first block is quick-listed
+    fit_class_t* fit;                   // per list, its fit and the statistics it is picked from, NULL
+                                        // (every list first fit) until the heap reaches FIT_HEAP_MIN
+    uint32_t page_map_pages;            // number of pages the page map covers
+    uint32_t slab_max;                  // requests up to this size go to the slabs, 0 turns them off
+    int arena;                          // memlib arena the heap lives in
+    int lock;                           // held by the thread working on this heap
+    int arenas_lock;                    // main heap only: held while a new arena is set up
+    unsigned num_threads;               // main heap only: threads that picked an arena so far
+    uint32_t mmap_threshold;            // requests of at least this size are mapped, 0 turns it off
+    uint32_t trim_threshold;            // a free tail of at least this size is trimmed by free, 0 turns it off
+    uint32_t purge_threshold;           // free decommits the pages inside free blocks this large, 0 turns it off
+    uint32_t grow_max;                  // largest chunk the heap grows by beyond a request, 0 turns it off
+    uint32_t grow_chunk;                // chunk of the next miss, adapted to how often misses come
+    uint32_t mallocs;                   // requests served so far (wrapping), the clock misses are measured with
+    uint32_t last_miss;                 // mallocs at the last time the heap had to grow
+    uint32_t quick_bytes;               // bytes in the quick lists
+    uint32_t quick_budget;              // the quick lists are consolidated when they hold more, 0 turns them off
+    uint32_t min_block;                 // smallest block size, 24 or MIN_BLOCK_COMPACT
+    uint32_t split_min;                 // a free block is split only if the rest is at least this large
+    uint8_t slab_warmup[SLAB_NUM_CLASSES];      // per slot size, requests served from blocks while it had no slab
+    uint8_t tcache_count;               // main heap only: blocks a tcache bin holds, 0 turns the caches off
+    bool compact;                       // MM_LAYOUT_COMPACT: 4-byte list links and blocks down to 8 bytes
+    bool tlsf;                          // MM_POLICY_TLSF: the two-level index follows the control block
+    bool fit_adapt;                     // fit_review picks the fit of every list, else all are first fit
+    size_t zero_lo;                     // the payload of the block arena_malloc returned last reads zero
+    size_t zero_hi;                     // from zero_lo up to zero_hi (empty if they are equal), for calloc
+} heap_ctl_t;
+
+static __thread heap_ctl_t* ctl;            // control block of the heap this thread is working on
+static __thread heap_ctl_t* home;           // control block of the arena this thread allocates from
+static __thread tcache_t* tcache;           // this thread's cache of freed blocks, NULL until first needed
+static __thread unsigned thread_epoch;      // heap_epoch when this thread picked its arena
+static unsigned heap_epoch;                 // bumped by mm_init, so threads drop state of an old heap
+static pthread_key_t tcache_key;            // its destructor returns the tcache of an exiting thread
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT; // creates tcache_key on the first tcache
+static int opt_policy = MM_POLICY_SEGLIST;  // free-block index used by the next mm_init
+static int opt_slab_max = SLAB_MAX_SIZE;    // slab limit used by the next mm_init
+static int opt_tcache_count = TCACHE_COUNT; // per-thread cache size used by the next mm_init
+static int opt_mmap_threshold = MMAP_THRESHOLD; // mapping threshold used by the next mm_init
+static int opt_trim_threshold = TRIM_THRESHOLD; // automatic trim threshold used by the next mm_init
+static int opt_purge_threshold = PURGE_THRESHOLD; // purge threshold used by the next mm_init
+static int opt_grow_max = GROW_MAX;         // growth chunk limit used by the next mm_init
+static int opt_quick_budget = QUICK_BUDGET; // quick list budget used by the next mm_init
+static int opt_layout = MM_LAYOUT_WIDE;     // free block layout used by the next mm_init
+static int opt_fit_adapt = 1;               // per-class fit choice used by the next mm_init
+
+// core functions and later helpers that the helpers call, with the arena's lock held
+static void* arena_malloc(size_t size);
+static void arena_free(void* ptr);
+static void quick_consolidate(void);
+static void* tcache_pop(int bin);
+static void free_to_owner(void* ptr);
+static void* mmap_malloc(size_t size, size_t alignment);
 
                                             /*****************************
                                              * START OF HELPER FUNCTIONS *
                                              *****************************/
 
-/***************************************************************************************
- *                              LIST OF HELPER FUNCTIONS:                              *
- *           1. ALIGN(NOT USED IN MY IMPLEMENTATION BUT KEPT FOR REFERENCE)            *
- *              2. ALIGNX: ALIGN THE SIZE OF THE BLOCK TO BE 24 + N * 16               *
- *             3. SET: SET THE VALUE OF A 64-BIT INTEGER AT THE ADDRESS A              *
- *                4. SETP: SET THE VALUE OF A POINTER AT THE ADDRESS A                 *
- * 5. EXTRACT_LAST_BIT(NOT USED BUT KEPT FOR REFERENCE): GET THE VALUE OF THE LAST BIT *
- *           6. EXTRACT_SIZE: GET THE VALUE OF THE SIZE OF THE CURRENT BLOCK           *
- *           7. EXTRACT_PREV_IS_FREE: GET THE VALUE OF THE BLOCK'S FREE BIT            *
- *       8. EXTRACT_CURR_IS_FREE: GET THE VALUE OF THE BLOCK'S PREVIOUS FREE BIT       *
- *          9. EXTRACT_NEXT_FREE_BLK: GET THE ADDRESS OF THE NEXT FREE BLOCK           *
- *       10. GET_FREE_LIST_INDEX: RETURN WHICH FREE LIST THE BLOCK SHOULD BE IN        *
- *            11. ADD_TO_FREE_LIST: ADD THE BLOCK TO THE DOUBLE LINKED LIST            *
- *       12. REMOVE_FROM_FREE_LIST: REMOVE THE BLOCK FROM THE DOUBLE LINKED LIST       *
- * 13. COALESCE: COALESCE THE BLOCK WITH THE PREVIOUS AND NEXT BLOCKS IF THEY ARE FREE *
- ***************************************************************************************/
+/********************************************************************************************
+ *                                LIST OF HELPER FUNCTIONS:                                 *
+ *              1. ALIGN(NOT USED IN MY IMPLEMENTATION BUT KEPT FOR REFERENCE)              *
+ *        2. ALIGNX: ALIGN THE BLOCK SIZE TO 8 + N * 16, AT LEAST 24 (8 IF COMPACT)         *
+ *                3. SET: SET THE VALUE OF A 64-BIT INTEGER AT THE ADDRESS A                *
+ *                   4. SETP: SET THE VALUE OF A POINTER AT THE ADDRESS A                   *
+ *   5. EXTRACT_LAST_BIT(NOT USED BUT KEPT FOR REFERENCE): GET THE VALUE OF THE LAST BIT    *
+ *             6. EXTRACT_SIZE: GET THE VALUE OF THE SIZE OF THE CURRENT BLOCK              *
+ *              7. EXTRACT_PREV_IS_FREE: GET THE VALUE OF THE BLOCK'S FREE BIT              *
+ *         8. EXTRACT_CURR_IS_FREE: GET THE VALUE OF THE BLOCK'S PREVIOUS FREE BIT          *
+ *             9. EXTRACT_NEXT_FREE_BLK: GET THE ADDRESS OF THE NEXT FREE BLOCK             *
+ *          10. GET_FREE_LIST_INDEX: RETURN WHICH FREE LIST THE BLOCK SHOULD BE IN          *
+ * 11. TLSF_INDEX/TLSF_MAPPING: THE TLSF INDEX OF CTL, THE FIRST AND SECOND LEVEL OF A SIZE *
+ *         12. FREE_LIST_HEAD: RETURN THE LIST HEAD A BLOCK OF THIS SIZE BELONGS TO         *
+ *              13. ADD_TO_FREE_LIST: ADD THE BLOCK TO THE DOUBLE LINKED LIST               *
+ *         14. REMOVE_FROM_FREE_LIST: REMOVE THE BLOCK FROM THE DOUBLE LINKED LIST          *
+ *   15. COALESCE: COALESCE THE BLOCK WITH THE PREVIOUS AND NEXT BLOCKS IF THEY ARE FREE    *
+ *              16. SEGLIST_FIND_FIT: FIRST FIT OVER THE SEGREGATED FREE LISTS              *
+ *            17. TLSF_FIND_FIT: GOOD FIT FROM THE TLSF BITMAPS IN CONSTANT TIME            *
+ *           18. FIND_FIT: FIND A FREE BLOCK WITH THE INDEX OF THE CURRENT POLICY           *
+ *           19. TREE_LEFT/TREE_RIGHT/TREE_PARENT: READ THE LINKS OF A TREE NODE            *
+ *          20. TREE_SET_LEFT/TREE_SET_RIGHT: LINK A CHILD AND ITS PARENT POINTER           *
+ *                 21. TREE_LESS: ORDER TREE NODES BY SIZE, THEN BY ADDRESS                 *
+ *              22. TREE_REPLACE: HANG A SUBTREE WHERE ANOTHER NODE USED TO BE              *
+ *                 23. TREE_ROTATE_LEFT/TREE_ROTATE_RIGHT: SINGLE ROTATIONS                 *
+ *             24. TREE_SPLAY: SPLAY A NODE TO THE ROOT OF THE LARGE BLOCK TREE             *
+ *                   25. TREE_INSERT: ADD A BLOCK TO THE LARGE BLOCK TREE                   *
+ *                26. TREE_REMOVE: REMOVE A BLOCK FROM THE LARGE BLOCK TREE                 *
+ *                27. TREE_BEST_FIT: SMALLEST LARGE BLOCK THAT FITS THE SIZE                *
+ *           28. IN_FREE_INDEX: TELL WHETHER A FREE BLOCK IS IN ITS LIST OR TREE            *
+ *                   29. EXTEND_HEAP: GROW THE HEAP BY AN ALLOCATED BLOCK                   *
+ *           30. ALIGNED_PAYLOAD: FIRST ALIGNED PAYLOAD THAT LEAVES A USABLE GAP            *
+ *            31. ALLOC_ALIGNED_BLOCK: ALLOCATE A BLOCK WITH AN ALIGNED PAYLOAD             *
+ *               32. SLAB_OF: FIND THE SLAB A POINTER IS IN WITH THE PAGE MAP               *
+ *                   33. PAGE_MAP_SET: MARK A HEAP PAGE AS A SLAB OR NOT                    *
+ *         34. SLAB_LIST_PUSH/SLAB_LIST_REMOVE: THE LISTS OF SLABS WITH FREE SLOTS          *
+ *               35. SLAB_MALLOC: TAKE A SLOT FROM A SLAB OF THE SIZE'S CLASS               *
+ *           36. SLAB_FREE: GIVE A SLOT BACK, AND AN EMPTY SLAB TO THE FREE LISTS           *
+ *              37. HEAP_LO/HEAP_HI: FIRST AND LAST BYTE OF THE CURRENT ARENA               *
+ *                     38. SPIN_LOCK/SPIN_UNLOCK: THE LOCK OF AN ARENA                      *
+ *                       39. ARENA_CTL: THE CONTROL BLOCK OF AN ARENA                       *
+ *                       40. ARENA_INIT: SET UP THE HEAP OF AN ARENA                        *
+ *               41. TCACHE_CREATE: ALLOCATE THE CACHE OF THE CURRENT THREAD                *
+ *             42. THREAD_ENTER: PICK THE ARENA AND CACHE OF THE CALLING THREAD             *
+ *                      43. TCACHE_BIN: THE CACHE BIN OF A BLOCK SIZE                       *
+ *                    44. TCACHE_GET: TAKE A BLOCK FROM THE THREAD CACHE                    *
+ *                           45. TCACHE_PUT: CACHE A FREED BLOCK                            *
+ *             46. REMOTE_PUSH: FREE A BLOCK OF ANOTHER ARENA WITHOUT ITS LOCK              *
+ *         47. REMOTE_DRAIN: FREE THE BLOCKS OTHER THREADS GAVE BACK, IN ONE BATCH          *
+ *               48. IS_MAPPED: TELL WHETHER A BLOCK HAS A MAPPING OF ITS OWN               *
+ *                49. MMAP_MALLOC: SERVE A LARGE REQUEST FROM A NEW MAPPING                 *
+ *                           50. MMAP_FREE: UNMAP A MAPPED BLOCK                            *
+ *              51. LAST_FREE_BLOCK: THE LAST BLOCK OF THE HEAP IF IT IS FREE               *
+ *               52. ARENA_TRIM: GIVE THE PAGES OF A FREE TAIL BACK TO MEMLIB               *
+ *              53. PURGE_BLOCK: DECOMMIT THE PAGES INSIDE A LARGE FREE BLOCK               *
+ *           54. EXTEND_LAST_BLOCK: GROW A FREE LAST BLOCK BY THE SHORTFALL ONLY            *
+ *              55. GROW_CHUNK: HOW FAR BEYOND A MISSED REQUEST THE HEAP GROWS              *
+ *              56. GROW_HEAP: GROW THE HEAP FOR A REQUEST NO FREE BLOCK FITS               *
+ *               57. QUICK_CONSOLIDATE: FREE THE QUICK-LISTED BLOCKS FOR REAL               *
+ *                   58. QUICK_PUT: KEEP A SMALL FREED BLOCK UNCOALESCED                    *
+ *               59. QUICK_GET: REUSE A QUICK-LISTED BLOCK OF THE EXACT SIZE                *
+ *          60. EXTRACT_PREV_BITS: THE PREV_IS_FREE AND PREV_MIN BITS OF A HEADER           *
+ *           61. SET_PREV_MIN: MARK WHETHER THE PREVIOUS BLOCK IS A MINIMUM BLOCK           *
+ *             62. PREV_FREE_BLOCK: THE HEADER OF THE FREE BLOCK BEFORE A BLOCK             *
+ *         63. GET_LINK/SET_LINK: THE FREE-LIST LINKS OF THE WIDE OR COMPACT LAYOUT         *
+ *            64. COMPARE_ADDRESSES: QSORT ORDER OF THE POINTERS OF A BATCH FREE            *
+ *              65. FREE_TO_OWNER: FREE A BLOCK THROUGH THE ARENA THAT OWNS IT              *
+ *       66. GROW_ALIGNED_TAIL: GROW THE HEAP FOR AN ALIGNED BLOCK NO FREE BLOCK FITS       *
+ *      67. FIND_ALIGNED_FIT: FIRST FREE BLOCK AN ALIGNED BLOCK FITS IN AFTER ITS GAP       *
+ *            68. TREE_NEXT: THE NEXT NODE OF THE LARGE BLOCK TREE IN SIZE ORDER            *
+ *      69. EXTRACT_ZERO/SET_ZERO: WHETHER A FREE BLOCK READS ZERO, AND MARKING IT SO       *
+ *        70. MMAP_REALLOC: RESIZE A MAPPED BLOCK BY MOVING ITS PAGES, NOT ITS BYTES        *
+ *                71. TCACHE_POP: TAKE THE FIRST BLOCK OF A THREAD CACHE BIN                *
+ *                  72. LIST_SORT: PUT A SEGREGATED LIST IN ADDRESS ORDER                   *
+ *            73. LIST_FIT: SEARCH ONE SEGREGATED LIST WITH THE FIT OF ITS CLASS            *
+ *         74. FIT_REVIEW: PICK A CLASS'S FIT FROM ITS LAST WINDOW, WITH HYSTERESIS         *
+ *          75. PROBE_FIT: FIND_FIT WITHOUT COUNTING THE SEARCH FOR THE FIT REVIEW          *
+ *          76. TCACHE_EXIT: RETURN THE TCACHE OF AN EXITING THREAD AND ITS BLOCKS          *
+ *               77. TCACHE_KEY_CREATE: CREATE THE KEY THAT RUNS TCACHE_EXIT                *
+ *    78. REMOTE_PUSH_CHAIN: PUSH LINKED BLOCKS ON ANOTHER ARENA'S REMOTE STACK AT ONCE     *
+ *       79. HEAP_SBRK: GROW THE HEAP, A COMPACT ONE NO FURTHER THAN ITS LINKS REACH        *
+ *      80. FIT_CREATE: ALLOCATE THE FIT STATISTICS OF A HEAP ONCE IT IS LARGE ENOUGH       *
+ ********************************************************************************************/
 
 /**************************************************
  *             HELPER FUNCTION: ALIGN             *
@@ -97,20 +330,22 @@ static size_t align(size_t x)
     return ALIGNMENT * ((x+ALIGNMENT-1)/ALIGNMENT);
 }
 
-/***********************************************************************************************
- *                                   HELPER FUNCTION: ALIGN                                    *
- *                   AFTER FOOTER OPTIMIZATION, SINCE THERE IS NO FOOTER IN                    *
- *                 A ALLOCATED BLOCK, THIS EXTRA 8 BYTES CAN BE USED AS A PART                 *
- *               OF THE PAYLOAD. TO ENSURE THAT THE PAYLOAD IS 16-BYTE ALIGNED,                *
- *           WE NEED TO ADJUST THE SIZE OF THE BLOCK TO BE 24 + N * MULTIPLE OF 16.            *
- *      ALSO, THE SIZE OF THE BLOCK SHOULD BE AT LEAST 24 BYTES SINCE A FREE BLOCK SHOULD      *
- * AT LEAST HAVE A HEADER, A FOOTER, A PREV POINTER AND A NEXT POINTER, WHICH IS 8 BYTES EACH. *
+/************************************************************************************************
+ *                                   HELPER FUNCTION: ALIGNX                                    *
+ *                    AFTER FOOTER OPTIMIZATION, SINCE THERE IS NO FOOTER IN                    *
+ *                 A ALLOCATED BLOCK, THIS EXTRA 8 BYTES CAN BE USED AS A PART                  *
+ *                OF THE PAYLOAD. TO ENSURE THAT THE PAYLOAD IS 16-BYTE ALIGNED,                *
+ *                  WE NEED TO ADJUST THE SIZE OF THE BLOCK TO BE 8 + N * 16.                   *
+ *      ALSO, THE SIZE OF THE BLOCK SHOULD BE AT LEAST 24 BYTES SINCE A FREE BLOCK SHOULD       *
+ * AT LEAST HAVE A HEADER, A FOOTER, A PREV POINTER AND A NEXT POINTER, WHICH IS 8 BYTES EACH.  *
+ *  WITH THE COMPACT LAYOUT THE TWO LINKS ARE 4 BYTES AND A MINIMUM BLOCK NEEDS NO FOOTER, SO   *
+ * THE SMALLEST BLOCK IS 8 BYTES INSTEAD (CTL->MIN_BLOCK), AND BLOCKS ARE 8, 24, 40, ... BYTES. *
  ***********************************************************************************************/
 
 static size_t alignx(size_t x)
 {
-    if ((8 + 16 * ((x + 15 - 8) / 16))<24){
-        return 24;
+    if ((8 + 16 * ((x + 15 - 8) / 16)) < ctl->min_block){
+        return ctl->min_block;
     } 
     return 8 + 16 * ((x + 15 - 8) / 16);
 }
@@ -129,6 +364,19 @@ static void setp(void* a, void* v) {
     *(void**)a = v;
 }
 
+/*******************************************
+ *    HELPER FUNCTION: HEAP_LO/HEAP_HI     *
+ * FIRST AND LAST BYTE OF THE CURRENT HEAP *
+ * (THE MEMLIB ARENA OF THE CONTROL BLOCK) *
+ *******************************************/
+static void* heap_lo(void) {
+    return mm_arena_lo(ctl->arena);
+}
+
+static void* heap_hi(void) {
+    return mm_arena_hi(ctl->arena);
+}
+
 /******************************
  * GET THE VALUE THE LAST BIT *
  ******************************/
@@ -142,7 +390,7 @@ static int extract_last_bit(void* ptr) {
  **************************************************/
 static size_t extract_size(void* ptr) {
     size_t value = *(size_t*)ptr;
-    return value >> 2;
+    return (value >> 2) & ~(size_t)0x7;   // sizes are multiples of 8, the low bits hold PREV_MIN
 }
 
 /*****************************************
@@ -150,7 +398,7 @@ static size_t extract_size(void* ptr) {
  *   RETURN 1 IF ALLOCATED, 0 IF FREE    *
  *****************************************/
 static int extract_prev_is_free(void* ptr) {
-    if (ptr == mm_heap_lo() + 3 * headerORFooter_SIZE) return 1; // prologue is not free
+    if (ptr == ctl->heap_start) return 1; // prologue is not free
     uint8_t value = *(uint8_t*)ptr;
     return value & 0x01;
 }
@@ -164,33 +412,337 @@ static int extract_curr_is_free(void* ptr) {
     return (value & 0x02) >> 1;
 }
 
+/******************************************************************
+ *  GET THE BITS OF THE HEADER THAT DESCRIBE THE PREVIOUS BLOCK   *
+ * (PREV_IS_FREE AND PREV_MIN), TO KEEP THEM WHEN IT IS REWRITTEN *
+ ******************************************************************/
+static int extract_prev_bits(void* ptr) {
+    uint8_t value = *(uint8_t*)ptr;
+    return value & (0x01 | PREV_MIN);
+}
+
+/************************************************************
+ *  SET OR CLEAR THE PREV_MIN BIT OF A BLOCK (OR EPILOGUE)  *
+ * ONLY READ WHILE THE PREVIOUS BLOCK IS FREE, SO IT IS SET *
+ *        WHEREVER A FREE BLOCK GETS ITS FINAL SIZE         *
+ ************************************************************/
+static void set_prev_min(void* ptr, bool prev_min) {
+    *(uint64_t*)ptr = (*(uint64_t*)ptr & ~(uint64_t)PREV_MIN) | (prev_min ? PREV_MIN : 0);
+}
+
+/****************************************************************
+ *  GET WHETHER A FREE BLOCK IS KNOWN TO READ ZERO: ALL OF ITS  *
+ * PAYLOAD BUT THE FIRST ZERO_SKIP BYTES (LINKS) AND THE FOOTER *
+ ****************************************************************/
+static bool extract_zero(void* block) {
+    return (*(uint8_t*)block & ZERO_BIT) != 0;
+}
+
+/************************************************************
+ * MARK A FREE BLOCK AS READING ZERO (HEADER AND FOOTER). A *
+ * HEADER WRITTEN AGAIN CLEARS THE BIT, SO A BLOCK THAT IS  *
+ *     SPLIT, MERGED OR MOVED IS NO LONGER MARKED ZERO      *
+ ************************************************************/
+static void set_zero(void* block) {
+    size_t size = extract_size(block);
+    if (size >= ZERO_MIN) {
+        *(uint64_t*)block |= ZERO_BIT;
+        *(uint64_t*)(block + size) |= ZERO_BIT;
+    }
+}
+
+/**************************************************************
+ *     GET THE HEADER OF THE FREE BLOCK BEFORE THIS ONE:      *
+ * FROM ITS FOOTER, OR 16 BYTES BACK IF IT IS A MINIMUM BLOCK *
+ **************************************************************/
+static void* prev_free_block(void* ptr) {
+    if (*(uint8_t*)ptr & PREV_MIN) {
+        return ptr - headerORFooter_SIZE - MIN_BLOCK_COMPACT;
+    }
+    return ptr - headerORFooter_SIZE - extract_size(ptr - headerORFooter_SIZE);
+}
+
+/*******************************************************************
+ *               HELPER FUNCTIONS: GET_LINK/SET_LINK               *
+ *  THE PREV AND NEXT LINKS OF A FREE BLOCK IN ITS LIST. THE WIDE  *
+ * LAYOUT KEEPS 8-BYTE POINTERS AT +8 AND +16. THE COMPACT LAYOUT  *
+ * KEEPS 4-BYTE OFFSETS FROM THE CONTROL BLOCK IN 16-BYTE UNITS AT *
+ * +8 AND +12 (0 IS NULL), SO A FREE BLOCK FITS IN 16 BYTES. THEY  *
+ *     REACH 64GB, HEAP_SBRK KEEPS A COMPACT HEAP WITHIN THAT.     *
+ *               TREE NODES ARE NOT LINKED THIS WAY                *
+ *******************************************************************/
+static void* get_link(void* block, int which) {
+    if (ctl->compact) {
+        uint32_t offset = *(uint32_t*)(block + headerORFooter_SIZE + 4 * which);
+        return offset == 0 ? NULL : (char*)ctl + ((size_t)offset << 4) + headerORFooter_SIZE;
+    }
+    return *(void**)(block + headerORFooter_SIZE + prev_SIZE * which);
+}
+
+static void set_link(void* block, int which, void* target) {
+    if (ctl->compact) {
+        // headers are 8 bytes past a 16-byte boundary, the shift drops those 8 bytes
+        *(uint32_t*)(block + headerORFooter_SIZE + 4 * which) =
+            target == NULL ? 0 : (uint32_t)(((char*)target - (char*)ctl) >> 4);
+        return;
+    }
+    setp(block + headerORFooter_SIZE + prev_SIZE * which, target);
+}
+
 /*****************************************
  * GET THE ADDRESS OF THE NEXT FREE BLK. *
  *****************************************/
 static int* extract_next_free_blk(void* ptr) {
-    int* value = *(int**)((char*)ptr + headerORFooter_SIZE + prev_SIZE);
+    int* value = get_link(ptr, LINK_NEXT);
     return value;
 }
 
 /*************************************************
  *     HELPER FUNCTION: GET_FREE_LIST_INDEX      *
  * RETURN WHICH FREE LIST THE BLOCK SHOULD BE IN *
+ *  FROM THE TABLES GEN_CLASSES.PL BUILT FROM A  *
+ *    SPEC IN CLASSES/ (MAKE CLASSES=...SPEC)    *
  *************************************************/
 static int get_free_list_index(size_t size) {
-    if (size == 1) return 0;
-    if (size == 2) return 1;
-    if (size >= 3 && size <= 4) return 2;
-    if (size >= 5 && size <= 8) return 3;
-    if (size >= 9 && size <= 16) return 4;
-    if (size >= 17 && size <= 32) return 5;
-    if (size >= 33 && size <= 64) return 6;
-    if (size >= 65 && size <= 128) return 7;
-    if (size >= 129 && size <= 256) return 8;
-    if (size >= 257 && size <= 512) return 9;
-    if (size >= 513 && size <= 1024) return 10;
-    if (size >= 1025 && size <= 2048) return 11;
-    if (size >= 2049 && size <= 4096) return 12;
-    return 13; // size is larger than 4096
+    if (size <= CLASS_TABLE_MAX) {
+        return class_table[(size - 1) >> CLASS_TABLE_SHIFT];
+    }
+    // every class bound above the table is a power of two, so the leading bit picks the class
+    return class_log2[63 - __builtin_clzll(size - 1)];
+}
+
+/****************************************************************
+ *                 HELPER FUNCTION: TLSF_INDEX                  *
+ * THE TLSF INDEX OF CTL, RIGHT AFTER ITS CONTROL BLOCK. ONLY A *
+ * HEAP SET UP WITH MM_POLICY_TLSF HAS ONE (CTL->TLSF), SO THE  *
+ *     CONTROL BLOCK OF A SEGLIST HEAP HOLDS NOTHING FOR IT     *
+ ****************************************************************/
+static tlsf_index_t* tlsf_index(void) {
+    return (tlsf_index_t*)((char*)ctl + align(sizeof(heap_ctl_t)));
+}
+
+/***************************************************************
+ *                HELPER FUNCTION: TLSF_MAPPING                *
+ *         FIRST LEVEL: POWER OF TWO RANGE OF THE SIZE         *
+ *           SECOND LEVEL: WHICH 1/16 OF THAT RANGE            *
+ * SIZES BELOW 256 ARE ALL IN FIRST LEVEL 0, 16 BYTES PER LIST *
+ ***************************************************************/
+static void tlsf_mapping(size_t size, int* fl, int* sl) {
+    if (size < (1 << TLSF_SMALL_LOG2)) {
+        *fl = 0;
+        *sl = size >> (TLSF_SMALL_LOG2 - TLSF_SL_LOG2);
+        return;
+    }
+    int log2 = 63 - __builtin_clzll(size);
+    *fl = log2 - TLSF_SMALL_LOG2 + 1;
+    // the bits right below the leading one pick the second level
+    *sl = (size >> (log2 - TLSF_SL_LOG2)) - TLSF_SL_COUNT;
+}
+
+/*********************************************************
+ *            HELPER FUNCTION: FREE_LIST_HEAD            *
+ * RETURN THE ADDRESS OF THE LIST HEAD THAT A FREE BLOCK *
+ *   OF THIS SIZE BELONGS TO UNDER THE CURRENT POLICY    *
+ *********************************************************/
+static void** free_list_head(size_t size) {
+    if (ctl->tlsf) {
+        int fl, sl;
+        tlsf_mapping(size, &fl, &sl);
+        return &tlsf_index()->heads[fl][sl];
+    }
+    return &ctl->free_lists[get_free_list_index(size)];
+}
+
+/************************************************************************
+ *                  HELPER FUNCTIONS: LARGE BLOCK TREE                  *
+ *  FREE BLOCKS ABOVE THE LAST CLASS BOUND (4096 BY DEFAULT) ARE NODES  *
+ * OF A SPLAY TREE KEYED BY SIZE, THEN ADDRESS, BUILT IN THEIR PAYLOAD: *
+ *         LEFT CHILD AT +8, RIGHT CHILD AT +16, PARENT AT +24.         *
+ *          THE ROOT IS KEPT IN FREE_LISTS[LARGE_TREE_CLASS].           *
+ *   SAME ROTATIONS AND SPLAY AS STREE.C, WITHOUT ANY NODE ALLOCATION   *
+ ************************************************************************/
+static void* tree_left(void* node) {
+    return *(void**)(node + headerORFooter_SIZE);
+}
+
+static void* tree_right(void* node) {
+    return *(void**)(node + headerORFooter_SIZE + prev_SIZE);
+}
+
+static void* tree_parent(void* node) {
+    return *(void**)(node + headerORFooter_SIZE + prev_SIZE + next_SIZE);
+}
+
+static void tree_set_left(void* node, void* child) {
+    setp(node + headerORFooter_SIZE, child);
+    if (child != NULL) setp(child + headerORFooter_SIZE + prev_SIZE + next_SIZE, node);
+}
+
+static void tree_set_right(void* node, void* child) {
+    setp(node + headerORFooter_SIZE + prev_SIZE, child);
+    if (child != NULL) setp(child + headerORFooter_SIZE + prev_SIZE + next_SIZE, node);
+}
+
+// true if block a orders before block b: smaller size first, then lower address
+static bool tree_less(void* a, void* b) {
+    size_t size_a = extract_size(a);
+    size_t size_b = extract_size(b);
+    return size_a < size_b || (size_a == size_b && a < b);
+}
+
+// put v where u hangs from its parent (or at the root)
+static void tree_replace(void* u, void* v) {
+    void* parent = tree_parent(u);
+    if (parent == NULL) {
+        ctl->free_lists[LARGE_TREE_CLASS] = v;
+        if (v != NULL) setp(v + headerORFooter_SIZE + prev_SIZE + next_SIZE, NULL);
+    } else if (tree_left(parent) == u) {
+        tree_set_left(parent, v);
+    } else {
+        tree_set_right(parent, v);
+    }
+}
+
+static void tree_rotate_left(void* x) {
+    void* y = tree_right(x);
+    tree_set_right(x, tree_left(y));
+    tree_replace(x, y);
+    tree_set_left(y, x);
+}
+
+static void tree_rotate_right(void* x) {
+    void* y = tree_left(x);
+    tree_set_left(x, tree_right(y));
+    tree_replace(x, y);
+    tree_set_right(y, x);
+}
+
+/*****************************************************************
+ *                  HELPER FUNCTION: TREE_SPLAY                  *
+ * MOVE THE NODE TO THE ROOT WITH ZIG, ZIG-ZIG AND ZIG-ZAG STEPS *
+ *****************************************************************/
+static void tree_splay(void* x) {
+    while (tree_parent(x) != NULL) {
+        void* parent = tree_parent(x);
+        void* grand = tree_parent(parent);
+        if (grand == NULL) {
+            // zig
+            if (tree_left(parent) == x) tree_rotate_right(parent);
+            else tree_rotate_left(parent);
+        } else if (tree_left(parent) == x && tree_left(grand) == parent) {
+            // zig-zig
+            tree_rotate_right(grand);
+            tree_rotate_right(parent);
+        } else if (tree_right(parent) == x && tree_right(grand) == parent) {
+            tree_rotate_left(grand);
+            tree_rotate_left(parent);
+        } else if (tree_left(parent) == x) {
+            // zig-zag
+            tree_rotate_right(parent);
+            tree_rotate_left(grand);
+        } else {
+            tree_rotate_left(parent);
+            tree_rotate_right(grand);
+        }
+    }
+}
+
+/************************************************************
+ *               HELPER FUNCTION: TREE_INSERT               *
+ * INSERT THE FREE BLOCK AS A LEAF AND SPLAY IT TO THE ROOT *
+ ************************************************************/
+static void tree_insert(void* block) {
+    setp(block + headerORFooter_SIZE, NULL);
+    setp(block + headerORFooter_SIZE + prev_SIZE, NULL);
+    setp(block + headerORFooter_SIZE + prev_SIZE + next_SIZE, NULL);
+
+    void* node = ctl->free_lists[LARGE_TREE_CLASS];
+    if (node == NULL) {
+        ctl->free_lists[LARGE_TREE_CLASS] = block;
+        return;
+    }
+    while (1) {
+        if (tree_less(block, node)) {
+            if (tree_left(node) == NULL) {
+                tree_set_left(node, block);
+                break;
+            }
+            node = tree_left(node);
+        } else {
+            if (tree_right(node) == NULL) {
+                tree_set_right(node, block);
+                break;
+            }
+            node = tree_right(node);
+        }
+    }
+    tree_splay(block);
+}
+
+/***************************************************
+ *          HELPER FUNCTION: TREE_REMOVE           *
+ * SPLAY THE BLOCK TO THE ROOT AND REPLACE IT WITH *
+ *        THE MINIMUM OF ITS RIGHT SUBTREE         *
+ ***************************************************/
+static void tree_remove(void* block) {
+    tree_splay(block);
+    void* left = tree_left(block);
+    void* right = tree_right(block);
+    if (left == NULL) {
+        tree_replace(block, right);
+    } else if (right == NULL) {
+        tree_replace(block, left);
+    } else {
+        void* y = right;
+        while (tree_left(y) != NULL) y = tree_left(y);
+        if (y != right) {
+            tree_replace(y, tree_right(y));
+            tree_set_right(y, right);
+        }
+        tree_replace(block, y);
+        tree_set_left(y, left);
+    }
+}
+
+/*********************************************************
+ *              HELPER FUNCTION: TREE_NEXT               *
+ * RETURN THE NODE AFTER THIS ONE IN SIZE (THEN ADDRESS) *
+ *             ORDER, NULL IF IT IS THE LAST             *
+ *********************************************************/
+static void* tree_next(void* node) {
+    if (tree_right(node) != NULL) {
+        node = tree_right(node);
+        while (tree_left(node) != NULL) {
+            node = tree_left(node);
+        }
+        return node;
+    }
+    void* parent = tree_parent(node);
+    while (parent != NULL && node == tree_right(parent)) {
+        node = parent;
+        parent = tree_parent(parent);
+    }
+    return parent;
+}
+
+/******************************************************
+ *           HELPER FUNCTION: TREE_BEST_FIT           *
+ * RETURN THE SMALLEST BLOCK OF AT LEAST SIZE BYTES,  *
+ * THE LOWEST ADDRESS AMONG EQUAL SIZES. NULL IF NONE *
+ ******************************************************/
+static void* tree_best_fit(size_t size) {
+    void* node = ctl->free_lists[LARGE_TREE_CLASS];
+    void* best = NULL;
+    while (node != NULL) {
+        if (extract_size(node) >= size) {
+            // large enough, but a smaller one may be on the left
+            best = node;
+            node = tree_left(node);
+        } else {
+            node = tree_right(node);
+        }
+    }
+    return best;
 }
 
 /*******************************************
@@ -200,31 +752,72 @@ static int get_free_list_index(size_t size) {
 static void add_to_free_list(void *block)
 {
     size_t size = extract_size(block);
-    int index = get_free_list_index(size);
-
-    void **free_list_head = &free_lists[index];
+    // the heap now ends in a free block: clear the epilogue's prev_is_free bit,
+    // so the last block is found without searching the free-block index
+    void* epilogue = heap_hi() - 7;
+    if (block + size + headerORFooter_SIZE == epilogue) {
+        set(epilogue, size == MIN_BLOCK_COMPACT ? PREV_MIN : 0x0);
+    }
+    if (!ctl->tlsf && get_free_list_index(size) == LARGE_TREE_CLASS) {
+        tree_insert(block);
+        return;
+    }
+    void **list_head = free_list_head(size);
+    if (ctl->fit != NULL) {
+        fit_class_t* fit = &ctl->fit[get_free_list_index(size)];
+        fit->length++;
+        if (fit->fit == MM_FIT_ADDRESS && fit->length > 2 * FIT_ADDRESS_MAX) {
+            // the list outgrew what fit_review keeps in address order: bounded best fit
+            // needs no order, so the walk below never gets longer than that
+            fit->fit = MM_FIT_BEST_OF;
+            fit->streak = 0;
+        }
+        if (fit->fit == MM_FIT_ADDRESS && *list_head != NULL && *list_head < block) {
+            // after the last block below it, the list stays in address order
+            void* prev = *list_head;
+            void* next;
+            while ((next = get_link(prev, LINK_NEXT)) != NULL && next < block) {
+                prev = next;
+            }
+            set_link(block, LINK_PREV, prev);
+            set_link(block, LINK_NEXT, next);
+            set_link(prev, LINK_NEXT, block);
+            if (next != NULL) {
+                set_link(next, LINK_PREV, block);
+            }
+            return;
+        }
+    }
 
     // add block to the head of the free list
-    if (*free_list_head != NULL)
+    if (*list_head != NULL)
     {
         // the free list is not empty
         // next ptr of the new head
-        setp(block + headerORFooter_SIZE + prev_SIZE, *free_list_head);
+        set_link(block, LINK_NEXT, *list_head);
         // set the previous pointer of the current head to the new block
-        setp((char *)*free_list_head + headerORFooter_SIZE, block);
+        set_link(*list_head, LINK_PREV, block);
         // set the previous pointer of the block(new head) to NULL
-        setp(block + headerORFooter_SIZE, NULL);
+        set_link(block, LINK_PREV, NULL);
     }
     else
     {
         // the free list is empty
         // set the next pointer of the block to NULL
-        setp(block + headerORFooter_SIZE + prev_SIZE, NULL);
+        set_link(block, LINK_NEXT, NULL);
         // set the previous pointer of the block to NULL
-        setp(block + headerORFooter_SIZE, NULL);
+        set_link(block, LINK_PREV, NULL);
     }
 
-    *free_list_head = block;
+    *list_head = block;
+
+    // mark the list and its first level as non-empty in the TLSF bitmaps
+    if (ctl->tlsf) {
+        int fl, sl;
+        tlsf_mapping(size, &fl, &sl);
+        tlsf_index()->sl_bitmap[fl] |= 1u << sl;
+        tlsf_index()->fl_bitmap |= 1ull << fl;
+    }
 }
 
 /************************************************
@@ -234,25 +827,44 @@ static void add_to_free_list(void *block)
  ************************************************/
 static void remove_from_free_list(void* block) {
     size_t size = extract_size(block);
-    int index = get_free_list_index(size);
-
-    void** free_list_head = &free_lists[index];
+    // the last block is taken (or about to be merged or resized): the epilogue follows an allocated block again
+    void* epilogue = heap_hi() - 7;
+    if (block + size + headerORFooter_SIZE == epilogue) {
+        set(epilogue, 0x1);
+    }
+    if (!ctl->tlsf && get_free_list_index(size) == LARGE_TREE_CLASS) {
+        tree_remove(block);
+        return;
+    }
+    void** list_head = free_list_head(size);
+    if (ctl->fit != NULL) {
+        ctl->fit[get_free_list_index(size)].length--;
+    }
 
-    void* prev = *(void**)(block + headerORFooter_SIZE);
-    void* next = *(void**)(block + headerORFooter_SIZE + prev_SIZE);
+    void* prev = get_link(block, LINK_PREV);
+    void* next = get_link(block, LINK_NEXT);
     if (prev != NULL) {
         // set the next pointer of the previous block to the next block
-        setp(prev + headerORFooter_SIZE + prev_SIZE, next);
+        set_link(prev, LINK_NEXT, next);
     } else {
         // the block is the first block in the free list
-        *free_list_head = next;
+        *list_head = next;
+        if (next == NULL && ctl->tlsf) {
+            // the list is now empty, clear its bit (and the first level's bit if it was the last list)
+            int fl, sl;
+            tlsf_mapping(size, &fl, &sl);
+            tlsf_index()->sl_bitmap[fl] &= ~(1u << sl);
+            if (tlsf_index()->sl_bitmap[fl] == 0) {
+                tlsf_index()->fl_bitmap &= ~(1ull << fl);
+            }
+        }
     }
     if (next != NULL) {
         // set the previous pointer of the next block to the previous block
-        setp(next + headerORFooter_SIZE, prev);
+        set_link(next, LINK_PREV, prev);
     }
-    setp(block + headerORFooter_SIZE, NULL);
-    setp(block + headerORFooter_SIZE + prev_SIZE, NULL);
+    set_link(block, LINK_PREV, NULL);
+    set_link(block, LINK_NEXT, NULL);
 }
 
 /*************************************************************************
@@ -261,9 +873,18 @@ static void remove_from_free_list(void* block) {
  *                           AFTER COALESCING:                           *
  *                 1.ADD THE NEW BLOCK TO THE FREE LIST                  *
  *            2.UPDATE THE PREV_IS_FREE BIT OF THE NEXT BLOCK            *
+ *                3.RETURN THE HEADER OF THE MERGED BLOCK                *
  *************************************************************************/
-static void coalesce(void* block) {
+static void* coalesce(void* block) {
     size_t size = extract_size(block);
+    fit_class_t* fit = NULL;
+    if (ctl->fit != NULL && get_free_list_index(size) != LARGE_TREE_CLASS) {
+        fit = &ctl->fit[get_free_list_index(size)];
+        if (++fit->frees == UINT16_MAX) {
+            fit->frees /= 2;
+            fit->merges /= 2;
+        }
+    }
 
     // Check if the previous block is free
     bool prev_is_free = extract_prev_is_free(block);
@@ -273,17 +894,20 @@ static void coalesce(void* block) {
         // 2. add the size of the previous block to the current block
         // 3. move the block_head pointer to the previous block
         // 4. remove the previous block from the free list
-        size_t prev_size = extract_size(block - headerORFooter_SIZE);
-        size += prev_size + headerORFooter_SIZE;
-        block -= prev_size + headerORFooter_SIZE;
+        void* prev_block = prev_free_block(block);
+        size += block - prev_block;
+        block = prev_block;
         remove_from_free_list(block);
     }
 
     // Check if the next block is free
     bool next_is_free = 1; // Initialize as false
-    if (block + size + headerORFooter_SIZE < mem_heap_hi() - 7) { // Check if next block is within heap
+    if (block + size + headerORFooter_SIZE < heap_hi() - 7) { // Check if next block is within heap
         next_is_free = extract_curr_is_free(block + size + headerORFooter_SIZE);
     }
+    if (fit != NULL && (prev_is_free == 0 || next_is_free == 0)) {
+        fit->merges++;
+    }
     if (next_is_free == 0) {
         //Here the sequence does not matter
         //add the size of the next block to the current block's size
@@ -296,12 +920,12 @@ static void coalesce(void* block) {
     
 
     // Update the Coalesced block's header and footer and add it to the free list
-    set(block, (size << 1) << 1 | extract_prev_is_free(block));
-    set(block + size , (size << 1) << 1 | extract_prev_is_free(block));
+    set(block, (size << 1) << 1 | extract_prev_bits(block));
+    set(block + size , (size << 1) << 1 | extract_prev_bits(block));
     add_to_free_list(block);
 
     // Update the extract_prev_is_free field of the next block
-     if (block + size + headerORFooter_SIZE < mem_heap_hi() - 7) { // Check if next block is within heap
+     if (block + size + headerORFooter_SIZE < heap_hi() - 7) { // Check if next block is within heap
         void* next_block = block + size + headerORFooter_SIZE;
         if (extract_curr_is_free(next_block) == 0) {
             set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 0);
@@ -310,7 +934,1175 @@ static void coalesce(void* block) {
         else{
             set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 0);
         }
+        set_prev_min(next_block, size == MIN_BLOCK_COMPACT);
      }
+    return block;
+}
+
+/***********************************************************
+ *               HELPER FUNCTION: LIST_SORT                *
+ * PUT A SEGREGATED LIST IN ADDRESS ORDER, WHEN ITS CLASS  *
+ * SWITCHES TO ADDRESS-ORDERED FIT. INSERTION SORT: SUCH A *
+ *        LIST HOLDS AT MOST FIT_ADDRESS_MAX BLOCKS        *
+ ***********************************************************/
+static void list_sort(int i) {
+    void* sorted = NULL;
+    void* fb = ctl->free_lists[i];
+    while (fb != NULL) {
+        void* rest = get_link(fb, LINK_NEXT);
+        if (sorted == NULL || fb < sorted) {
+            set_link(fb, LINK_NEXT, sorted);
+            sorted = fb;
+        } else {
+            void* prev = sorted;
+            while (get_link(prev, LINK_NEXT) != NULL && get_link(prev, LINK_NEXT) < fb) {
+                prev = get_link(prev, LINK_NEXT);
+            }
+            set_link(fb, LINK_NEXT, get_link(prev, LINK_NEXT));
+            set_link(prev, LINK_NEXT, fb);
+        }
+        fb = rest;
+    }
+    // the previous links follow the new order
+    void* prev = NULL;
+    for (fb = sorted; fb != NULL; fb = get_link(fb, LINK_NEXT)) {
+        set_link(fb, LINK_PREV, prev);
+        prev = fb;
+    }
+    ctl->free_lists[i] = sorted;
+}
+
+/************************************************************
+ *                HELPER FUNCTION: LIST_FIT                 *
+ * SEARCH ONE SEGREGATED LIST WITH ITS FIT: THE FIRST BLOCK *
+ * THAT IS LARGE ENOUGH (IN LIFO OR ADDRESS ORDER), OR THE  *
+ * SMALLEST OF THE FIRST FIT_BEST_OF ONES. ADDS THE BLOCKS  *
+ *                  IT LOOKED AT TO STEPS                   *
+ ************************************************************/
+static void* list_fit(int i, size_t size, uint32_t* steps) {
+    void* best = NULL;
+    int found = 0;
+    bool best_of = ctl->fit != NULL && ctl->fit[i].fit == MM_FIT_BEST_OF;
+    for (void* fb = ctl->free_lists[i]; fb != NULL; fb = get_link(fb, LINK_NEXT)) {
+        (*steps)++;
+        size_t fb_size = extract_size(fb);
+        if (fb_size < size) {
+            continue;
+        }
+        if (!best_of || fb_size == size) {
+            return fb;
+        }
+        if (best == NULL || fb_size < extract_size(best)) {
+            best = fb;
+        }
+        if (++found == FIT_BEST_OF) {
+            break;
+        }
+    }
+    return best;
+}
+
+/**************************************************************
+ *                HELPER FUNCTION: FIT_REVIEW                 *
+ * AT THE END OF A CLASS'S WINDOW, PICK ITS FIT FOR THE NEXT: *
+ *  FIRST FIT WHILE FEW SEARCHES SPLIT THE BLOCK THEY TAKE,   *
+ * ELSE ADDRESS-ORDERED FIT IF MOST FREES MERGE AND THE LIST  *
+ * AND ITS SEARCHES ARE SHORT, ELSE BOUNDED BEST FIT. A CLASS *
+ * ONLY SWITCHES AFTER FIT_HYSTERESIS REVIEWS IN A ROW ASKED  *
+ *   FOR THE SAME OTHER FIT, AND EACH THRESHOLD FAVOURS THE   *
+ *           CURRENT FIT, SO THE CHOICE CANNOT FLAP           *
+ **************************************************************/
+static void fit_review(int i) {
+    fit_class_t* fit = &ctl->fit[i];
+    bool first = fit->fit == MM_FIT_FIRST;
+    bool address = fit->fit == MM_FIT_ADDRESS;
+    // first fit is left above 3/8 of the searches splitting, and taken again below 2/8
+    bool splitting = fit->splits * 8 >= fit->searches * (first ? 3 : 2);
+    bool merging = fit->merges * 8 >= fit->frees * (address ? 3 : 4) && fit->frees != 0;
+    bool short_list = fit->length <= (address ? 2 * FIT_ADDRESS_MAX : FIT_ADDRESS_MAX);
+    bool short_search = fit->steps <= fit->searches * (address ? 2 * FIT_BEST_OF : FIT_BEST_OF);
+    int want = !splitting ? MM_FIT_FIRST : (merging && short_list && short_search) ? MM_FIT_ADDRESS : MM_FIT_BEST_OF;
+
+    if (want == fit->fit) {
+        fit->streak = 0;
+    } else if (want == fit->vote && fit->streak > 0) {
+        fit->streak++;
+    } else {
+        fit->vote = want;
+        fit->streak = 1;
+    }
+    if (fit->streak >= FIT_HYSTERESIS) {
+        if (want == MM_FIT_ADDRESS) {
+            list_sort(i);
+        }
+        fit->fit = want;
+        fit->streak = 0;
+    }
+    fit->searches = fit->steps = fit->splits = fit->frees = fit->merges = 0;
+}
+
+/********************************************************************
+ *                   HELPER FUNCTION: FIT_CREATE                    *
+ * CALLED WITH CTL'S LOCK HELD ONCE THE HEAP REACHED FIT_HEAP_MIN:  *
+ * ALLOCATE THE FIT STATISTICS OF ITS LISTS, ALL FIRST FIT AS UNTIL *
+ * NOW, AND COUNT THE BLOCKS IN EACH LIST. A SMALL HEAP NEVER PAYS  *
+ * FOR THEM, NOR FOR A BLOCK PINNED AMONG ITS FEW OTHERS. FIT_ADAPT *
+ *      IS OFF MEANWHILE, SO THAT THE MALLOC DOES NOT RECURSE       *
+ ********************************************************************/
+static void fit_create(void) {
+    ctl->fit_adapt = false;
+    fit_class_t* fit = arena_malloc(NUM_FREE_LISTS * sizeof(fit_class_t));
+    ctl->fit_adapt = true;
+    if (fit == NULL) {
+        return; // first fit everywhere, the next malloc tries again
+    }
+    mm_memset(fit, 0, NUM_FREE_LISTS * sizeof(fit_class_t));
+    for (int i = 0; i < LARGE_TREE_CLASS; i++) {
+        for (void* fb = ctl->free_lists[i]; fb != NULL; fb = get_link(fb, LINK_NEXT)) {
+            fit[i].length++;
+        }
+    }
+    ctl->fit = fit;
+}
+
+/***************************************************************
+ *              HELPER FUNCTION: SEGLIST_FIND_FIT              *
+ *   RETURN A BLOCK THAT IS LARGE ENOUGH, STARTING FROM THE    *
+ *   SIZE'S OWN SEGREGATED LIST, EACH LIST SEARCHED WITH ITS   *
+ *    FIT. THE LARGE BLOCK TREE IS SEARCHED LAST, WITH BEST    *
+ * FIT. IF COUNTED, THE SEARCH COUNTS TOWARDS THE SIZE'S CLASS *
+ ***************************************************************/
+static void* seglist_find_fit(size_t size, bool counted) {
+    int first = get_free_list_index(size);
+    uint32_t steps = 0;
+    void* fb = NULL;
+    for (int i = first; i < LARGE_TREE_CLASS && fb == NULL; i++) {
+        fb = list_fit(i, size, &steps);
+    }
+    if (counted && ctl->fit != NULL && first != LARGE_TREE_CLASS) {
+        fit_class_t* fit = &ctl->fit[first];
+        fit->steps = fit->steps + steps < UINT16_MAX ? fit->steps + steps : UINT16_MAX;
+        if (++fit->searches == FIT_WINDOW) {
+            fit_review(first);
+        }
+    }
+    if (fb != NULL) {
+        return fb;
+    }
+    // nothing in the lists, the tree gives the best fit among the large blocks
+    return tree_best_fit(size);
+}
+
+/********************************************************************
+ *                  HELPER FUNCTION: TLSF_FIND_FIT                  *
+ *    GOOD FIT IN CONSTANT TIME: THE HEAD OF THE SIZE'S OWN LIST    *
+ * IF IT IS LARGE ENOUGH, OTHERWISE THE HEAD OF THE FIRST NON-EMPTY *
+ *   LIST AFTER IT, FOUND WITH FIND-FIRST-SET ON THE TWO BITMAPS    *
+ ********************************************************************/
+static void* tlsf_find_fit(size_t size) {
+    tlsf_index_t* tlsf = tlsf_index();
+    int fl, sl;
+    tlsf_mapping(size, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT) {
+        return NULL; // larger than any heap
+    }
+
+    // the size's own list may hold smaller blocks too, only its head is tried
+    void* head = tlsf->heads[fl][sl];
+    if (head != NULL && extract_size(head) >= size) {
+        return head;
+    }
+
+    // every block in a later list is large enough
+    uint32_t sl_map = tlsf->sl_bitmap[fl] & (~0u << sl << 1);
+    if (sl_map == 0) {
+        // nothing left in this first level, go to the next non-empty one
+        uint64_t fl_map = tlsf->fl_bitmap & (~0ull << (fl + 1));
+        if (fl_map == 0) {
+            return NULL;
+        }
+        fl = __builtin_ctzll(fl_map);
+        sl_map = tlsf->sl_bitmap[fl];
+    }
+    return tlsf->heads[fl][__builtin_ctz(sl_map)];
+}
+
+/*******************************************************
+ *           HELPER FUNCTION: IN_FREE_INDEX            *
+ * RETURN TRUE IF THE BLOCK IS IN THE FREE-BLOCK INDEX *
+ *******************************************************/
+static bool in_free_index(void* block) {
+    size_t size = extract_size(block);
+    if (!ctl->tlsf && get_free_list_index(size) == LARGE_TREE_CLASS) {
+        void* node = ctl->free_lists[LARGE_TREE_CLASS];
+        while (node != NULL && node != block) {
+            node = tree_less(block, node) ? tree_left(node) : tree_right(node);
+        }
+        return node != NULL;
+    }
+    // walk the list the block's size belongs to
+    int* fb = *free_list_head(size);
+    while (fb != NULL) {
+        if (fb == block) {
+            return true;
+        }
+        fb = extract_next_free_blk(fb);
+    }
+    return false;
+}
+
+/********************************************
+ *        HELPER FUNCTION: FIND_FIT         *
+ * FIND A FREE BLOCK OF AT LEAST SIZE BYTES *
+ *   WITH THE INDEX OF THE CURRENT POLICY   *
+ *       RETURN NULL IF THERE IS NONE       *
+ ********************************************/
+static void* find_fit(size_t size) {
+    if (ctl->tlsf) {
+        return tlsf_find_fit(size);
+    }
+    return seglist_find_fit(size, true);
+}
+
+/**************************************************************
+ *                 HELPER FUNCTION: PROBE_FIT                 *
+ * FIND_FIT FOR A CALLER THAT ONLY ASKS WHETHER A BLOCK FITS: *
+ * THE SEARCH IS NOT COUNTED, SO IT DOES NOT SKEW FIT_REVIEW  *
+ **************************************************************/
+static void* probe_fit(size_t size) {
+    if (ctl->tlsf) {
+        return tlsf_find_fit(size);
+    }
+    return seglist_find_fit(size, false);
+}
+
+/************************************************************
+ *             HELPER FUNCTION: LAST_FREE_BLOCK             *
+ * THE LAST BLOCK OF THE HEAP IF IT IS FREE, NULL OTHERWISE *
+ *    READ FROM THE EPILOGUE, THE INDEX IS NOT SEARCHED     *
+ ************************************************************/
+static void* last_free_block(void) {
+    // the free index keeps the epilogue's prev_is_free bit up to date, and a free block
+    // has a footer, so the last block is found in constant time
+    void* epilogue = heap_hi() - 7;
+    if (extract_prev_is_free(epilogue) == 1) {
+        return NULL;
+    }
+    return prev_free_block(epilogue);
+}
+
+/******************************************************************
+ *                   HELPER FUNCTION: HEAP_SBRK                   *
+ * GROW THE HEAP OF CTL BY INCR BYTES LIKE MM_ARENA_SBRK, BUT NOT *
+ *  A COMPACT HEAP PAST COMPACT_HEAP_MAX, WHERE ITS 4-BYTE LINKS  *
+ *            WOULD NOT REACH (SEE GET_LINK/SET_LINK)             *
+ ******************************************************************/
+static void* heap_sbrk(size_t incr) {
+    if (ctl->compact && (size_t)((char*)heap_hi() + 1 - (char*)ctl) + incr > COMPACT_HEAP_MAX) {
+        return (void *)-1;
+    }
+    return mm_arena_sbrk(ctl->arena, incr);
+}
+
+/******************************************************************
+ *                  HELPER FUNCTION: EXTEND_HEAP                  *
+ * GROW THE HEAP BY AN ALLOCATED BLOCK OF THE (ALIGNED) SIZE THAT *
+ *  TAKES THE PLACE OF THE EPILOGUE, AND RETURN ITS PAYLOAD. THE  *
+ * NEW EPILOGUE IS WRITTEN RIGHT AFTER IT. NULL IF OUT OF MEMORY  *
+ ******************************************************************/
+static void* extend_heap(size_t size) {
+    size_t block_size = size + headerORFooter_SIZE;
+    // allocate the new block
+    void* new_block = heap_sbrk(block_size);
+    if (new_block == (void *)-1) {
+        return NULL; // error in expanding heap
+    }
+    new_block -= headerORFooter_SIZE;
+
+    // check if the heap is empty currently;
+    if (new_block == ctl->heap_start){
+        // if the heap is empty, set the prev_is_free bit of the new block to 1 because the prologue is not free
+        set(new_block, ((size << 1 | 0x01)<<1 )| 0x1);
+        // update the epilogue header
+        set(new_block + block_size, 0x1);
+    }else{
+        // if the heap is not empty, the new block keeps the bits of the epilogue it replaces: prev_is_free
+        // (0 if the current last block is free) and PREV_MIN (if that block is a minimum block)
+        set(new_block, ((size << 1 | 0x01)<<1 )| extract_prev_bits(new_block));
+        set(new_block + block_size, 0x1);
+
+    }
+    void* ret = new_block + headerORFooter_SIZE;
+    return ret;
+}
+
+/********************************************************************
+ *                HELPER FUNCTION: EXTEND_LAST_BLOCK                *
+ * THE HEAP ENDS IN A FREE BLOCK TOO SMALL FOR THE (ALIGNED) SIZE:  *
+ *   GROW THE HEAP BY THE SHORTFALL ONLY, ALLOCATE THE FREE BLOCK   *
+ * WITH THE NEW BYTES AND RETURN ITS PAYLOAD. NULL IF OUT OF MEMORY *
+ ********************************************************************/
+static void* extend_last_block(void* last, size_t size) {
+    // both sizes are 24 + 16n, so the shortfall keeps the epilogue aligned
+    if (heap_sbrk(size - extract_size(last)) == (void *)-1) {
+        return NULL; // error in expanding heap
+    }
+    remove_from_free_list(last);
+    set(last, (size << 1 | 0x01) << 1 | extract_prev_bits(last));
+    set(last + size + headerORFooter_SIZE, 0x1);    // set epilogue header
+    return last + headerORFooter_SIZE;
+}
+
+/****************************************************************
+ *                 HELPER FUNCTION: GROW_CHUNK                  *
+ * THE BYTES TO GROW THE HEAP BY BEYOND THE REQUEST THAT MISSED *
+ *   MISSES IN A BURST DOUBLE THE CHUNK, A QUIET PHASE HALVES   *
+ *  IT, AND IT NEVER GROWS PAST A SHARE OF THE HEAP, THE LIMIT  *
+ *          OR HALF THE TRIM THRESHOLD. 0 FOR NO CHUNK          *
+ ****************************************************************/
+static size_t grow_chunk(void) {
+    if (ctl->mallocs - ctl->last_miss < GROW_WINDOW) {
+        ctl->grow_chunk = ctl->grow_chunk == 0 ? GROW_MIN : 2 * ctl->grow_chunk;
+    } else {
+        ctl->grow_chunk /= 2;
+    }
+    ctl->last_miss = ctl->mallocs;
+
+    size_t limit = mm_arena_size(ctl->arena) / GROW_HEAP_SHARE;
+    if (ctl->grow_max < limit) {
+        limit = ctl->grow_max;
+    }
+    if (ctl->trim_threshold != 0 && ctl->trim_threshold / 2 < limit) {
+        limit = ctl->trim_threshold / 2;    // so the next free does not trim the chunk again
+    }
+    if (ctl->grow_chunk > limit) {
+        ctl->grow_chunk = limit;
+    }
+    if (ctl->grow_chunk < GROW_MIN) {
+        ctl->grow_chunk = 0;
+    }
+    return ctl->grow_chunk / 16 * 16;   // keeps the sizes 24 + 16n
+}
+
+/*****************************************************************
+ *                  HELPER FUNCTION: GROW_HEAP                   *
+ * NO FREE BLOCK FITS THE (ALIGNED) SIZE: GROW THE HEAP FOR IT,  *
+ * FROM A FREE LAST BLOCK IF THERE IS ONE, PLUS THE GROWTH CHUNK *
+ * WHICH STAYS AT THE END AS A FREE BLOCK FOR THE NEXT REQUESTS. *
+ *           RETURN THE PAYLOAD, NULL IF OUT OF MEMORY           *
+ *****************************************************************/
+static void* grow_heap(size_t size) {
+    size_t chunk = grow_chunk();
+    void* last = last_free_block();
+    size_t last_size = last != NULL ? extract_size(last) : 0;
+    bool last_zero = last != NULL && extract_zero(last);
+    // the new bytes read as zero unless the break was reset over them
+    bool fresh = (char*)mm_arena_fresh(ctl->arena) <= (char*)heap_hi() + 1;
+    void* ptr = last != NULL ? extend_last_block(last, size + chunk) : extend_heap(size + chunk);
+    if (ptr == NULL && chunk != 0) {
+        // no room for the chunk, try the request alone
+        ctl->grow_chunk = 0;
+        chunk = 0;
+        ptr = last != NULL ? extend_last_block(last, size) : extend_heap(size);
+    }
+    if (ptr == NULL) {
+        return NULL;
+    }
+    if (fresh) {
+        // the payload reads zero from the new bytes on, or from the old links on if the free
+        // last block read zero too: its footer and the old epilogue are cleared for that
+        ctl->zero_lo = last_size == 0 ? 0 : last_size + headerORFooter_SIZE;
+        ctl->zero_hi = size;
+        if (last_zero) {
+            set(last + last_size, 0);
+            set(last + last_size + headerORFooter_SIZE, 0);
+            ctl->zero_lo = ZERO_SKIP;
+        }
+    }
+    if (chunk == 0) {
+        return ptr;
+    }
+    // cut the chunk off as the new free last block
+    void* block = ptr - headerORFooter_SIZE;
+    set(block, (size << 1 | 0x01) << 1 | extract_prev_bits(block));
+    void* rest = block + size + headerORFooter_SIZE;
+    set(rest, ((chunk - headerORFooter_SIZE) << 1) << 1 | 0x1);
+    set(rest + chunk - headerORFooter_SIZE, ((chunk - headerORFooter_SIZE) << 1) << 1 | 0x1);
+    add_to_free_list(rest);
+    if (fresh) {
+        set_zero(rest);
+    }
+    return ptr;
+}
+
+/*****************************************************************
+ *               HELPER FUNCTION: ALIGNED_PAYLOAD                *
+ * THE FIRST ALIGNED PAYLOAD AT OR AFTER THE BLOCK'S OWN PAYLOAD *
+ *    THAT LEAVES NO GAP OR A GAP BIG ENOUGH FOR A FREE BLOCK    *
+ *****************************************************************/
+static char* aligned_payload(void* block, size_t alignment) {
+    char* payload = (char*)(((uintptr_t)block + headerORFooter_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    size_t gap = payload - headerORFooter_SIZE - (char*)block;
+    if (gap != 0 && gap < 4 * headerORFooter_SIZE) {
+        // too small for a free block, take the next boundary
+        payload += alignment;
+    }
+    return payload;
+}
+
+/*****************************************************************
+ *              HELPER FUNCTION: FIND_ALIGNED_FIT                *
+ * FIRST FIT FOR AN ALIGNED BLOCK OVER THE SEGREGATED LISTS: THE *
+ * FIRST FREE BLOCK THAT HOLDS THE (ALIGNED) SIZE AFTER ITS OWN  *
+ *  GAP, WHICH IS USUALLY MUCH LESS THAN THE WORST ONE. THE TREE *
+ *   AND THE TLSF LISTS ARE LEFT TO FIND_FIT WITH THE WORST GAP  *
+ *****************************************************************/
+static void* find_aligned_fit(size_t size, size_t alignment) {
+    if (ctl->tlsf) {
+        return NULL;
+    }
+    for (int i = get_free_list_index(size); i < LARGE_TREE_CLASS; i++) {
+        void* fb = ctl->free_lists[i];
+        while (fb != NULL) {
+            if (aligned_payload(fb, alignment) + size <= (char*)fb + headerORFooter_SIZE + extract_size(fb)) {
+                return fb;
+            }
+            fb = extract_next_free_blk(fb);
+        }
+    }
+    // the tree in size order, up to the blocks that hold even the worst gap
+    size_t want = size + alignment + 4 * headerORFooter_SIZE;
+    for (void* node = tree_best_fit(size); node != NULL && extract_size(node) < want; node = tree_next(node)) {
+        if (aligned_payload(node, alignment) + size <= (char*)node + headerORFooter_SIZE + extract_size(node)) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************
+ *               HELPER FUNCTION: GROW_ALIGNED_TAIL              *
+ *   NO FREE BLOCK HAS ROOM FOR THE WORST GAP: GROW THE HEAP SO  *
+ *  THAT ITS FREE LAST BLOCK (OR A NEW ONE AT THE EPILOGUE) ENDS *
+ * JUST AFTER AN ALIGNED BLOCK OF THE SIZE. ONLY THE BYTES UP TO *
+ *   THE FIRST USABLE BOUNDARY ARE ADDED, THE FREE TAIL IN FRONT *
+ *  IS USED FIRST. RETURN THE FREE BLOCK, NULL IF OUT OF MEMORY  *
+ *****************************************************************/
+static void* grow_aligned_tail(size_t size, size_t alignment) {
+    void* epilogue = heap_hi() - 7;
+    void* last = last_free_block();
+    void* start = last != NULL ? last : epilogue;
+    char* block_end = aligned_payload(start, alignment) + size;
+    // headers are 8 bytes past a 16-byte boundary and so is block_end, the growth keeps that
+    if (heap_sbrk(block_end - (char*)epilogue) == (void *)-1) {
+        return NULL;
+    }
+    int prev_bits = extract_prev_bits(start);
+    if (start == ctl->heap_start) {
+        prev_bits = 0x1;    // the prologue is not free
+    }
+    if (last != NULL) {
+        remove_from_free_list(last);
+    }
+    size_t free_size = block_end - (char*)start - headerORFooter_SIZE;
+    set(block_end, 0x1);    // the new epilogue
+    set(start, (free_size << 1) << 1 | prev_bits);
+    set(block_end - headerORFooter_SIZE, (free_size << 1) << 1 | prev_bits);
+    add_to_free_list(start);
+    return start;
+}
+
+/******************************************************************
+ *              HELPER FUNCTION: ALLOC_ALIGNED_BLOCK              *
+ * ALLOCATE A BLOCK WHOSE PAYLOAD STARTS ON AN ALIGNMENT BOUNDARY *
+ * (A POWER OF TWO). A FREE BLOCK WITH ROOM FOR THE WORST GAP IS  *
+ *  CUT IN UP TO THREE: THE GAP IN FRONT AND THE REST AFTER THE   *
+ *     BLOCK GO BACK TO THE FREE LISTS IF THEY ARE BIG ENOUGH     *
+ ******************************************************************/
+static void* alloc_aligned_block(size_t size, size_t alignment) {
+    size = alignx(size);
+    // the gap in front is either empty or a whole free block, which is at least 32 bytes
+    size_t want = size + alignment + 4 * headerORFooter_SIZE;
+    void* fb = find_aligned_fit(size, alignment);
+    if (fb == NULL) {
+        fb = find_fit(want);
+    }
+    if (fb == NULL && ctl->quick_bytes != 0) {
+        // like arena_malloc, coalesce the quick-listed blocks before the heap grows
+        quick_consolidate();
+        fb = find_aligned_fit(size, alignment);
+        if (fb == NULL) {
+            fb = find_fit(want);
+        }
+    }
+    if (fb == NULL && ctl->mmap_threshold != 0 && size >= ctl->mmap_threshold && alignment <= mm_pagesize()) {
+        // a large block gets a mapping of its own, which is page aligned
+        return mmap_malloc(size, alignment);
+    }
+    if (fb == NULL) {
+        fb = grow_aligned_tail(size, alignment);
+        if (fb == NULL) {
+            return NULL;
+        }
+    }
+    size_t free_size = extract_size(fb);
+    int prev_is_free = extract_prev_is_free(fb);
+    remove_from_free_list(fb);
+
+    char* payload = aligned_payload(fb, alignment);
+    size_t gap = payload - headerORFooter_SIZE - (char*)fb;
+    void* block = payload - headerORFooter_SIZE;
+    if (gap != 0) {
+        // the gap in front becomes a free block
+        set(fb, ((gap - headerORFooter_SIZE) << 1) << 1 | prev_is_free);
+        set(fb + gap - headerORFooter_SIZE, ((gap - headerORFooter_SIZE) << 1) << 1 | prev_is_free);
+        add_to_free_list(fb);
+        prev_is_free = 0;
+    }
+
+    size_t remaining_size = free_size - gap - size;
+    if (remaining_size >= 4 * headerORFooter_SIZE) {
+        // the rest becomes a free block, the block after it still follows a free block
+        set(block, (size << 1 | 0x01) << 1 | prev_is_free);
+        set(block + size + headerORFooter_SIZE, ((remaining_size - headerORFooter_SIZE) << 1) << 1 | 0x01);
+        set(block + size + remaining_size, ((remaining_size - headerORFooter_SIZE) << 1) << 1 | 0x01);
+        add_to_free_list(block + size + headerORFooter_SIZE);
+    } else {
+        // the rest is too small, keep it in the block
+        size += remaining_size;
+        set(block, (size << 1 | 0x01) << 1 | prev_is_free);
+
+        // set the next block's prev_is_free bit
+        if (block + size + headerORFooter_SIZE < heap_hi() - 7) {
+            void* next_block = block + size + headerORFooter_SIZE;
+            if (extract_curr_is_free(next_block) == 0) {
+                set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 1);
+                set(next_block + extract_size(next_block), ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 1);
+            }
+            else{
+                set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 1);
+            }
+        }
+    }
+    return payload;
+}
+
+/*********************************************************
+ *               HELPER FUNCTION: SLAB_OF                *
+ *  RETURN THE SLAB THE POINTER IS IN, NULL IF THE PAGE  *
+ * IS NOT A SLAB (THE POINTER IS THE PAYLOAD OF A BLOCK) *
+ *********************************************************/
+static slab_t* slab_of(void* ptr) {
+    size_t page = (uintptr_t)ptr / SLAB_PAGE_SIZE - (uintptr_t)heap_lo() / SLAB_PAGE_SIZE;
+    // no lock needed: the size is read before the map and old maps stay valid
+    if (page >= __atomic_load_n(&ctl->page_map_pages, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    uint8_t* map = __atomic_load_n(&ctl->page_map, __ATOMIC_ACQUIRE);
+    if (((__atomic_load_n(&map[page / 8], __ATOMIC_RELAXED) >> (page % 8)) & 1) == 0) {
+        return NULL;
+    }
+    return (slab_t*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+}
+
+/************************************************************
+ *              HELPER FUNCTION: PAGE_MAP_SET               *
+ *  MARK OR UNMARK A HEAP PAGE AS A SLAB. THE PAGE MAP IS   *
+ * AN ORDINARY BLOCK, REPLACED BY ONE TWICE AS BIG WHEN THE *
+ *           HEAP GROWS PAST THE PAGES IT COVERS            *
+ ************************************************************/
+static bool page_map_set(void* page_ptr, bool is_slab) {
+    size_t page = (uintptr_t)page_ptr / SLAB_PAGE_SIZE - (uintptr_t)heap_lo() / SLAB_PAGE_SIZE;
+    if (page >= ctl->page_map_pages) {
+        size_t pages = ctl->page_map_pages != 0 ? ctl->page_map_pages : PAGE_MAP_INIT_PAGES;
+        while (pages <= page) {
+            pages *= 2;
+        }
+        uint8_t* map = arena_malloc(pages / 8);
+        if (map == NULL) {
+            return false;
+        }
+        mm_memset(map, 0, pages / 8);
+        if (ctl->page_map != NULL) {
+            // the old map is not freed: another thread may be reading it in slab_of without the lock
+            mm_memcpy(map, ctl->page_map, ctl->page_map_pages / 8);
+        }
+        // publish the map before its size, so a reader never indexes past the map it sees
+        __atomic_store_n(&ctl->page_map, map, __ATOMIC_RELEASE);
+        __atomic_store_n(&ctl->page_map_pages, pages, __ATOMIC_RELEASE);
+    }
+    if (is_slab) {
+        __atomic_fetch_or(&ctl->page_map[page / 8], 1 << (page % 8), __ATOMIC_RELEASE);
+    } else {
+        __atomic_fetch_and(&ctl->page_map[page / 8], ~(1 << (page % 8)), __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+/****************************************************
+ *     HELPER FUNCTIONS: SLAB_LIST_PUSH/REMOVE      *
+ * THE DOUBLE LINKED LIST OF SLABS WITH A FREE SLOT *
+ ****************************************************/
+static void slab_list_push(slab_t** head, slab_t* slab) {
+    // address order: the lowest slabs fill up first and the high ones get a chance to empty
+    slab_t* prev = NULL;
+    slab_t* next = *head;
+    while (next != NULL && next < slab) {
+        prev = next;
+        next = next->next;
+    }
+    slab->prev = prev;
+    slab->next = next;
+    if (next != NULL) {
+        next->prev = slab;
+    }
+    if (prev != NULL) {
+        prev->next = slab;
+    } else {
+        *head = slab;
+    }
+}
+
+static void slab_list_remove(slab_t** head, slab_t* slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/*********************************************************
+ *             HELPER FUNCTION: SLAB_MALLOC              *
+ *   TAKE THE FIRST FREE SLOT OF THE FIRST SLAB OF THE   *
+ * SIZE'S CLASS. A NEW PAGE-ALIGNED SLAB IS MADE IF NONE *
+ *  OF THEM HAS A FREE SLOT. A CLASS THAT NEVER HAD ONE  *
+ *  GETS IT ONLY AFTER SLAB_WARMUP OF ITS REQUESTS, SO   *
+ *  A FEW SMALL BLOCKS DO NOT TAKE A WHOLE PAGE: UNTIL   *
+ *   THEN NULL SENDS THEM TO AN ORDINARY BLOCK INSTEAD   *
+ *********************************************************/
+static void* slab_malloc(size_t size) {
+    int slab_class = size == 0 ? 0 : (size - 1) / ALIGNMENT;
+    slab_t** head = &ctl->slabs[slab_class];
+    slab_t* slab = *head;
+    if (slab == NULL) {
+        // a class keeps its last slab once it has one (slab_free), so this only counts before the first
+        if (ctl->slab_warmup[slab_class] < SLAB_WARMUP) {
+            ctl->slab_warmup[slab_class]++;
+            return NULL;
+        }
+        slab = alloc_aligned_block(SLAB_BLOCK_SIZE, SLAB_PAGE_SIZE);
+        if (slab == NULL) {
+            return NULL;
+        }
+        if (!page_map_set(slab, true)) {
+            arena_free(slab);
+            return NULL;
+        }
+        mm_memset(slab, 0, sizeof(slab_t));
+        slab->slot_size = (slab_class + 1) * ALIGNMENT;
+        slab->num_slots = (SLAB_BLOCK_SIZE - align(sizeof(slab_t))) / slab->slot_size;
+        slab->num_free = slab->num_slots;
+        slab_list_push(head, slab);
+    }
+
+    // first clear bit of the slot bitmap, there is one since the slab is in the list
+    int i = 0;
+    while (~slab->used[i / 64] == 0) {
+        i += 64;
+    }
+    i += __builtin_ctzll(~slab->used[i / 64]);
+    slab->used[i / 64] |= 1ull << (i % 64);
+    slab->num_free--;
+    if (slab->num_free == 0) {
+        slab_list_remove(head, slab);
+    }
+    return (char*)slab + align(sizeof(slab_t)) + i * slab->slot_size;
+}
+
+/*************************************************************
+ *                HELPER FUNCTION: SLAB_FREE                 *
+ * CLEAR THE SLOT'S BIT. A SLAB THAT BECOMES EMPTY IS GIVEN  *
+ * BACK AS A FREE BLOCK, UNLESS IT IS THE LAST ONE WITH FREE *
+ *      SLOTS IN ITS CLASS (SO A CLASS DOES NOT THRASH)      *
+ *************************************************************/
+static void slab_free(slab_t* slab, void* ptr) {
+    slab_t** head = &ctl->slabs[slab->slot_size / ALIGNMENT - 1];
+    int i = ((char*)ptr - (char*)slab - align(sizeof(slab_t))) / slab->slot_size;
+    slab->used[i / 64] &= ~(1ull << (i % 64));
+    if (slab->num_free == 0) {
+        slab_list_push(head, slab);
+    }
+    slab->num_free++;
+    if (slab->num_free == slab->num_slots && (*head != slab || slab->next != NULL)) {
+        slab_list_remove(head, slab);
+        page_map_set(slab, false);
+        arena_free(slab);
+    }
+}
+
+/******************************************************
+ *      HELPER FUNCTIONS: SPIN_LOCK/SPIN_UNLOCK       *
+ * THE LOCK OF AN ARENA (OR OF THE TABLE OF ARENAS).  *
+ * ONLY HELD FOR ONE CALL INTO THE ARENA, SO SPINNING *
+ * IS CHEAPER THAN GOING TO SLEEP. BUT A HOLDER THAT  *
+ * WAS PREEMPTED KEEPS IT FOR A WHOLE TIMESLICE, SO A *
+ * WAITER YIELDS AFTER SPIN_MAX LOOKS AT A HELD LOCK  *
+ ******************************************************/
+static void spin_lock(int* lock) {
+    int spins = 0;
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        // wait with plain loads until it looks free, then try again
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+            if (++spins == SPIN_MAX) {
+                spins = 0;
+                sched_yield();
+            }
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();    // lets the other hyperthread run and leaves the loop without a misspeculation
+#elif defined(__aarch64__)
+            __asm__ __volatile__("yield");
+#endif
+        }
+    }
+}
+
+static void spin_unlock(int* lock) {
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+/****************************************************
+ *            HELPER FUNCTION: ARENA_CTL            *
+ * THE CONTROL BLOCK IS AT THE START OF EVERY ARENA *
+ ****************************************************/
+static heap_ctl_t* arena_ctl(int arena) {
+    return mm_arena_lo(arena);
+}
+
+/*************************************************************
+ *                HELPER FUNCTION: ARENA_INIT                *
+ *  SET UP AN EMPTY HEAP IN A MEMLIB ARENA AND MAKE IT CTL:  *
+ * THE CONTROL BLOCK (AND THE TLSF INDEX WHEN THAT POLICY IS *
+ *    SELECTED), THEN THE PADDING, PROLOGUE AND EPILOGUE     *
+ *************************************************************/
+static bool arena_init(int arena) {
+    // the main heap takes the tunables at mm_init, the other arenas copy what it took,
+    // so an mm_mallopt call since then does not reach them either
+    heap_ctl_t* main_heap = arena == 0 ? NULL : arena_ctl(0);
+    bool tlsf = main_heap != NULL ? main_heap->tlsf : opt_policy == MM_POLICY_TLSF;
+    size_t ctl_size = align(sizeof(heap_ctl_t));
+    size_t tlsf_size = tlsf ? align(sizeof(tlsf_index_t)) : 0;
+    void* heap = mm_arena_sbrk(arena, ctl_size + tlsf_size + INIT_SIZE);
+    if (heap == (void *)-1) {
+        return false;
+    }
+    // all free lists are empty and all bitmaps are clear
+    mm_memset(heap, 0, ctl_size + tlsf_size + INIT_SIZE);
+    ctl = heap;
+    ctl->arena = arena;
+    ctl->tlsf = tlsf_size != 0;
+    heap += ctl_size + tlsf_size;
+    ctl->heap_start = heap + 3 * headerORFooter_SIZE;
+    if (main_heap != NULL) {
+        ctl->slab_max = main_heap->slab_max;
+        ctl->mmap_threshold = main_heap->mmap_threshold;
+        ctl->trim_threshold = main_heap->trim_threshold;
+        ctl->purge_threshold = main_heap->purge_threshold;
+        ctl->grow_max = main_heap->grow_max;
+        ctl->quick_budget = main_heap->quick_budget;
+        ctl->compact = main_heap->compact;
+        ctl->fit_adapt = main_heap->fit_adapt;
+    } else {
+        ctl->slab_max = opt_slab_max;
+        ctl->mmap_threshold = opt_mmap_threshold;
+        ctl->trim_threshold = opt_trim_threshold;
+        ctl->purge_threshold = opt_purge_threshold;
+        ctl->grow_max = opt_grow_max;
+        ctl->quick_budget = opt_quick_budget;
+        ctl->compact = opt_layout == MM_LAYOUT_COMPACT;
+        ctl->fit_adapt = opt_fit_adapt;
+    }
+    ctl->min_block = ctl->compact ? MIN_BLOCK_COMPACT : 24;
+    // the spec may ask for a larger rest than the smallest block, if hardly anything requests less
+    size_t split_min = CLASS_SPLIT_MIN;
+    ctl->split_min = split_min > ctl->min_block ? split_min : ctl->min_block;
+    
+    set (heap, 0);
+    set (heap + headerORFooter_SIZE, 0x11);        // set prologue header
+    set (heap + 2 * headerORFooter_SIZE, 0x11);    // set prologue footer
+    set (heap + 3 * headerORFooter_SIZE, 0x1);       //set epilogue header
+    return true;
+}
+
+/**********************************************************
+ *              HELPER FUNCTION: TCACHE_EXIT              *
+ * DESTRUCTOR OF TCACHE_KEY, RUN BY A THREAD AS IT EXITS: *
+ *   FREE EVERY CACHED BLOCK TO THE ARENA THAT OWNS IT,   *
+ *      THEN THE TCACHE ITSELF TO THE THREAD'S ARENA      *
+ **********************************************************/
+static void tcache_exit(void* cache) {
+    // after an mm_init the cache and its blocks belong to the old heap, which is gone
+    if (cache != tcache || thread_epoch != __atomic_load_n(&heap_epoch, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    for (int bin = 0; bin < TCACHE_NUM_BINS; bin++) {
+        void* ptr;
+        while ((ptr = tcache_pop(bin)) != NULL) {
+            ctl = arena_ctl(mm_arena_of(ptr));
+            free_to_owner(ptr);
+        }
+    }
+    tcache = NULL;
+    ctl = home;
+    free_to_owner(cache);
+}
+
+/************************************************
+ *      HELPER FUNCTION: TCACHE_KEY_CREATE      *
+ * RUN ONCE, BY THE FIRST TCACHE_CREATE: CREATE *
+ *   THE KEY WHOSE DESTRUCTOR IS TCACHE_EXIT    *
+ ************************************************/
+static void tcache_key_create(void) {
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/**************************************************************
+ *               HELPER FUNCTION: TCACHE_CREATE               *
+ * ALLOCATE AN EMPTY TCACHE FOR THE CALLING THREAD IN ITS OWN *
+ *    ARENA (CTL MUST BE HOME). NULL IF THE CACHES ARE OFF    *
+ *   EITHER WAY IT BECOMES THE THREAD'S VALUE OF TCACHE_KEY   *
+ **************************************************************/
+static tcache_t* tcache_create(void) {
+    pthread_once(&tcache_once, tcache_key_create);
+    tcache_t* cache = NULL;
+    if (arena_ctl(0)->tcache_count != 0) {
+        spin_lock(&home->lock);
+        cache = arena_malloc(sizeof(tcache_t));
+        spin_unlock(&home->lock);
+    }
+    if (cache != NULL) {
+        mm_memset(cache, 0, sizeof(tcache_t));
+    }
+    // also clears a tcache of an old heap, so the destructor only sees the current one
+    pthread_setspecific(tcache_key, cache);
+    return cache;
+}
+
+/**************************************************************
+ *               HELPER FUNCTION: THREAD_ENTER                *
+ *  CALLED FIRST BY EVERY MALLOC AND FREE. A THREAD THAT HAS  *
+ *  NOT PICKED AN ARENA FOR THIS HEAP YET GETS THE NEXT ONE   *
+ * ROUND ROBIN (SET UP ON FIRST USE), AND A NEW TCACHE IN IT. *
+ *               THEN CTL IS THE THREAD'S ARENA               *
+ **************************************************************/
+static void thread_enter(void) {
+    unsigned epoch = __atomic_load_n(&heap_epoch, __ATOMIC_ACQUIRE);
+    if (home == NULL || thread_epoch != epoch) {
+        heap_ctl_t* main_heap = arena_ctl(0);
+        int arena = __atomic_fetch_add(&main_heap->num_threads, 1, __ATOMIC_RELAXED) % MEM_MAX_ARENAS;
+        spin_lock(&main_heap->arenas_lock);
+        if (mm_arena_size(arena) == 0 && !arena_init(arena)) {
+            arena = 0; // no room for another heap, share the main one
+        }
+        spin_unlock(&main_heap->arenas_lock);
+        home = arena_ctl(arena);
+        thread_epoch = epoch;
+        ctl = home;
+        tcache = tcache_create();
+    }
+    ctl = home;
+}
+
+/**********************************************
+ *        HELPER FUNCTION: TCACHE_BIN         *
+ * THE BIN OF A BLOCK SIZE (24 + N * 16) IS N *
+ **********************************************/
+static int tcache_bin(size_t size) {
+    return (size - TCACHE_MIN_SIZE) / ALIGNMENT;
+}
+
+/*********************************************
+ *        HELPER FUNCTION: TCACHE_POP        *
+ * TAKE THE FIRST BLOCK OF A BIN, NULL IF IT *
+ *    IS EMPTY. THE CALLER CHECKED TCACHE    *
+ *********************************************/
+static void* tcache_pop(int bin) {
+    void* ptr = tcache->heads[bin];
+    if (ptr != NULL) {
+        tcache->heads[bin] = *(void**)ptr;
+        tcache->counts[bin]--;
+    }
+    return ptr;
+}
+
+/*******************************************************
+ *             HELPER FUNCTION: TCACHE_GET             *
+ * TAKE A CACHED BLOCK OF THE REQUEST'S ALIGNED SIZE,  *
+ * WITHOUT ANY LOCK. NULL FOR REQUESTS THE SLABS SERVE *
+ *******************************************************/
+static void* tcache_get(size_t size) {
+    if (tcache == NULL || size <= ctl->slab_max || alignx(size) < TCACHE_MIN_SIZE || alignx(size) > TCACHE_MAX_SIZE) {
+        return NULL;
+    }
+    return tcache_pop(tcache_bin(alignx(size)));
+}
+
+/*******************************************************
+ *             HELPER FUNCTION: TCACHE_PUT             *
+ * CACHE A FREED BLOCK (NOT A SLOT), WITHOUT ANY LOCK. *
+ *  SIZE IS THE BLOCK'S SIZE, OR FOR A SIZED FREE THE  *
+ *  ALIGNED SIZE OF THE REQUEST, WHICH MAY BE SMALLER  *
+ *      FALSE IF IT IS TOO BIG OR ITS BIN IS FULL      *
+ *******************************************************/
+static bool tcache_put(void* ptr, size_t size) {
+    if (tcache == NULL || size < TCACHE_MIN_SIZE || size > TCACHE_MAX_SIZE) {
+        return false;
+    }
+    int bin = tcache_bin(size);
+    if (tcache->counts[bin] >= arena_ctl(0)->tcache_count) {
+        return false;
+    }
+    *(void**)ptr = tcache->heads[bin];
+    tcache->heads[bin] = ptr;
+    tcache->counts[bin]++;
+    return true;
+}
+
+/**************************************************************
+ *                 HELPER FUNCTION: QUICK_GET                 *
+ *  CALLED WITH CTL'S LOCK HELD: TAKE A BLOCK OF EXACTLY THE  *
+ * (ALIGNED) SIZE FROM THE QUICK LISTS, NULL IF THERE IS NONE *
+ **************************************************************/
+static void* quick_get(size_t size) {
+    if (ctl->quick_bytes == 0 || size < TCACHE_MIN_SIZE || size > TCACHE_MAX_SIZE) {
+        return NULL;
+    }
+    int bin = tcache_bin(size);
+    void* ptr = ctl->quick[bin];
+    if (ptr != NULL) {
+        ctl->quick[bin] = *(void**)ptr;
+        ctl->quick_bytes -= size + headerORFooter_SIZE;
+    }
+    return ptr;
+}
+
+/**************************************************************
+ *             HELPER FUNCTION: QUICK_CONSOLIDATE             *
+ * CALLED WITH CTL'S LOCK HELD: FREE EVERY BLOCK OF THE QUICK *
+ *   LISTS FOR REAL, SO IT IS COALESCED WITH ITS NEIGHBORS    *
+ **************************************************************/
+static void quick_consolidate(void) {
+    // one block at a time, so the lists and their byte count agree whenever arena_free runs
+    for (int bin = 0; bin < TCACHE_NUM_BINS; bin++) {
+        void* ptr;
+        while ((ptr = quick_get(TCACHE_MIN_SIZE + bin * ALIGNMENT)) != NULL) {
+            arena_free(ptr);
+        }
+    }
+}
+
+/***************************************************************
+ *                 HELPER FUNCTION: QUICK_PUT                  *
+ * CALLED WITH CTL'S LOCK HELD: KEEP A FREED BLOCK OF A SMALL  *
+ *    SIZE IN THE ARENA'S QUICK LIST OF THAT SIZE, WITHOUT     *
+ *  COALESCING IT. IT STAYS ALLOCATED AS FAR AS ITS NEIGHBORS  *
+ * KNOW. PASSING THE BYTE BUDGET CONSOLIDATES ALL QUICK LISTS. *
+ *          FALSE IF THE BLOCK MUST BE FREED NORMALLY          *
+ ***************************************************************/
+static bool quick_put(void* ptr) {
+    if (ctl->quick_budget == 0 || slab_of(ptr) != NULL) {
+        return false;
+    }
+    size_t size = extract_size(ptr - headerORFooter_SIZE);
+    if (size < TCACHE_MIN_SIZE || size > TCACHE_MAX_SIZE) {
+        return false;
+    }
+    if (ctl->quick == NULL) {
+        // the first block to quick-list: the list heads come from the heap too
+        void** quick = arena_malloc(TCACHE_NUM_BINS * sizeof(void*));
+        if (quick == NULL) {
+            return false;
+        }
+        mm_memset(quick, 0, TCACHE_NUM_BINS * sizeof(void*));
+        ctl->quick = quick;
+    }
+    int bin = tcache_bin(size);
+    *(void**)ptr = ctl->quick[bin];
+    ctl->quick[bin] = ptr;
+    ctl->quick_bytes += size + headerORFooter_SIZE;
+    if (ctl->quick_bytes > ctl->quick_budget) {
+        quick_consolidate();
+    }
+    return true;
+}
+
+/***********************************************************
+ *           HELPER FUNCTION: REMOTE_PUSH_CHAIN            *
+ * PUSH A CHAIN OF BLOCKS OF ANOTHER ARENA, ALREADY LINKED *
+ *   FROM FIRST TO LAST THROUGH THEIR FIRST WORD, ON ITS   *
+ *       REMOTE STACK WITH A SINGLE COMPARE-AND-SWAP       *
+ ***********************************************************/
+static void remote_push_chain(heap_ctl_t* arena, void* first, void* last) {
+    void* head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+    do {
+        *(void**)last = head;
+    } while (!__atomic_compare_exchange_n(&arena->remote_frees, &head, first, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**********************************************************
+ *              HELPER FUNCTION: REMOTE_PUSH              *
+ * FREE A BLOCK OF ANOTHER ARENA WITHOUT TAKING ITS LOCK: *
+ * PUSH IT ON THE ARENA'S REMOTE STACK WITH COMPARE-AND-  *
+ *  SWAP. ONLY A DRAIN EVER POPS, AND IT TAKES THE WHOLE  *
+ *           STACK AT ONCE, SO THERE IS NO ABA            *
+ **********************************************************/
+static void remote_push(heap_ctl_t* arena, void* ptr) {
+    remote_push_chain(arena, ptr, ptr);
+}
+
+/*********************************************************
+ *             HELPER FUNCTION: REMOTE_DRAIN             *
+ *  CALLED WITH CTL'S LOCK HELD: TAKE EVERY BLOCK OTHER  *
+ * THREADS HAVE PUSHED SO FAR AND FREE THEM IN ONE BATCH *
+ *********************************************************/
+static void remote_drain(void) {
+    // a plain load first, so the common empty case does not take the cache line
+    if (__atomic_load_n(&ctl->remote_frees, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    void* ptr = __atomic_exchange_n(&ctl->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while (ptr != NULL) {
+        void* next = *(void**)ptr;
+        if (!quick_put(ptr)) {
+            arena_free(ptr);
+        }
+        ptr = next;
+    }
+}
+
+/**********************************************************
+ *              HELPER FUNCTION: ARENA_TRIM               *
+ * SHRINK THE LAST FREE BLOCK TO AT LEAST PAD BYTES, GIVE *
+ * THE WHOLE PAGES ABOVE IT BACK TO MEMLIB AND WRITE THE  *
+ *  EPILOGUE AT THE NEW END. FALSE IF NOTHING WAS FREED   *
+ **********************************************************/
+static bool arena_trim(size_t pad) {
+    void* last = last_free_block();
+    if (last == NULL || extract_size(last) < alignx(pad)) {
+        return false;
+    }
+    size_t page = mm_pagesize();
+    size_t release = (extract_size(last) - alignx(pad)) / page * page;
+    if (release == 0) {
+        return false;
+    }
+    // the block keeps its place, only its size (and so its list) changes
+    bool zero = extract_zero(last);
+    remove_from_free_list(last);
+    size_t size = extract_size(last) - release;
+    set(last, ((size << 1) << 1) | extract_prev_bits(last));
+    set(last + size, ((size << 1) << 1) | extract_prev_bits(last));
+    add_to_free_list(last);
+    if (zero) {
+        set_zero(last);
+    }
+    mm_arena_sbrk(ctl->arena, -(intptr_t)release);
+    set(heap_hi() - 7, 0x0);    // set epilogue header, the block before it is still free
+    set_prev_min(heap_hi() - 7, size == MIN_BLOCK_COMPACT);
+    return true;
+}
+
+/*********************************************************
+ *             HELPER FUNCTION: PURGE_BLOCK              *
+ *  DECOMMIT THE WHOLE PAGES OF [LO, HI) INSIDE A FREE   *
+ *   BLOCK. THE HEADER, THE LIST OR TREE LINKS AND THE   *
+ * FOOTER STAY, SO THE BLOCK IS STILL A NORMAL MEMBER OF *
+ * THE FREE INDEX. THE PARTIAL PAGES AT THE EDGES ARE    *
+ *    CLEARED, SO ALL OF [LO, HI) READS ZERO AFTERWARDS  *
+ *********************************************************/
+static void purge_block(void* block, void* lo, void* hi) {
+    // header, prev/left, next/right and parent come first, the footer is last
+    void* first = block + 4 * headerORFooter_SIZE;
+    void* last = block + extract_size(block);
+    lo = lo > first ? lo : first;
+    hi = hi < last ? hi : last;
+    if (lo < hi) {
+        size_t page = mm_pagesize();
+        void* lo_page = (void*)(((uintptr_t)lo + page - 1) & ~(uintptr_t)(page - 1));
+        void* hi_page = (void*)((uintptr_t)hi & ~(uintptr_t)(page - 1));
+        if (lo_page >= hi_page) {
+            memset(lo, 0, hi - lo);
+            return;
+        }
+        memset(lo, 0, lo_page - lo);
+        memset(hi_page, 0, hi - hi_page);
+        mm_purge(lo, hi - lo);
+    }
+}
+
+/**********************************************************
+ *               HELPER FUNCTION: IS_MAPPED               *
+ * TELL WHETHER A PAYLOAD IS IN A MAPPING OF ITS OWN: ALL *
+ *  OTHER BLOCKS AND SLOTS ARE IN THE REGION OF AN ARENA  *
+ **********************************************************/
+static bool is_mapped(void* ptr) {
+    return mm_arena_of(ptr) < 0;
+}
+
+/****************************************************************
+ *                 HELPER FUNCTION: MMAP_MALLOC                 *
+ *    GIVE A LARGE REQUEST A MAPPING OF ITS OWN. THE PAYLOAD    *
+ * STARTS AT THE ALIGNMENT (AT MOST A PAGE) OR 16 BYTES IN, AND *
+ *  THE PADDING WORD BEFORE ITS HEADER HOLDS THAT OFFSET. THE   *
+ * HEADER HOLDS THE PAYLOAD SIZE (THE REST OF THE WHOLE PAGES)  *
+ *                  SO FREE CAN UNMAP IT AGAIN                  *
+ ****************************************************************/
+static void* mmap_malloc(size_t size, size_t alignment) {
+    size_t page = mm_pagesize();
+    size_t offset = alignment > MMAP_HEADER_SIZE ? alignment : MMAP_HEADER_SIZE;
+    size_t length = (size + offset + page - 1) / page * page;
+    void* map = mm_mmap(length);
+    if (map == (void *)-1) {
+        return NULL;
+    }
+    set(map + offset - MMAP_HEADER_SIZE, offset);
+    set(map + offset - headerORFooter_SIZE, ((length - offset) << 1 | 0x01) << 1 | 0x1);
+    return map + offset;
+}
+
+/******************************************************
+ *             HELPER FUNCTION: MMAP_FREE             *
+ * GIVE THE WHOLE MAPPING OF A MAPPED BLOCK BACK. THE *
+ *  PAGES GO BACK TO THE SYSTEM, NOT TO A FREE LIST   *
+ ******************************************************/
+static void mmap_free(void* ptr) {
+    size_t offset = *(size_t*)(ptr - MMAP_HEADER_SIZE);
+    mm_munmap(ptr - offset, extract_size(ptr - headerORFooter_SIZE) + offset);
+}
+
+/**************************************************************
+ *               HELPER FUNCTION: MMAP_REALLOC                *
+ *  RESIZE A MAPPED BLOCK BY RESIZING ITS MAPPING. MEMLIB     *
+ *  GROWS IT IN PLACE OR MOVES ITS PAGES, SO THE PAYLOAD IS   *
+ * NEVER COPIED. THE OFFSET WORD MOVES ALONG WITH THE PAGES.  *
+ *        NULL IF THE MAPPING COULD NOT BE RESIZED            *
+ **************************************************************/
+static void* mmap_realloc(void* ptr, size_t size) {
+    size_t page = mm_pagesize();
+    size_t offset = *(size_t*)(ptr - MMAP_HEADER_SIZE);
+    size_t old_length = extract_size(ptr - headerORFooter_SIZE) + offset;
+    size_t length = (size + offset + page - 1) / page * page;
+    void* map = mm_mremap(ptr - offset, old_length, length);
+    if (map == (void *)-1) {
+        return NULL;
+    }
+    set(map + offset - headerORFooter_SIZE, ((length - offset) << 1 | 0x01) << 1 | 0x1);
+    return map + offset;
 }
 
                                             /***************************
@@ -320,14 +2112,23 @@ static void coalesce(void* block) {
                                             /***************************
                                              * Start OF CORE FUNCTIONS *
                                              ***************************/
-/********************************************************************************************
- *                                 LIST OF CORE FUNCTIONS:                                  *
- *                    1. MM_INIT: INITIALIZE THE HEAP AND THE FREE LISTS                    *
- *                          2. MALLOC: ALLOCATE A BLOCK OF MEMORY                           *
- *                             3. FREE: FREE A BLOCK OF MEMORY                              *
- *                         4. REALLOC: REALLOCATE A BLOCK OF MEMORY                         *
- * 5. CALLOC: ALLOCATE A BLOCK OF MEMORY AND SET IT TO ZERO (NOT USED IN MY IMPLEMENTATION) *
- ********************************************************************************************/
+/************************************************************************************************
+ *                                   LIST OF CORE FUNCTIONS:                                    *
+ *                      1. MM_INIT: INITIALIZE THE HEAP AND THE FREE LISTS                      *
+ *                      2. MM_MALLOPT: SET A TUNABLE FOR THE NEXT MM_INIT                       *
+ *                 3. MM_TRIM: GIVE THE FREE TAILS OF THE HEAPS BACK TO MEMLIB                  *
+ *             4. ARENA_MALLOC: ALLOCATE A BLOCK FROM THE CURRENT ARENA (LOCK HELD)             *
+ *                 5. ARENA_FREE: FREE A BLOCK OF THE CURRENT ARENA (LOCK HELD)                 *
+ *            6. ARENA_REALLOC: REALLOCATE A BLOCK OF THE CURRENT ARENA (LOCK HELD)             *
+ *        7. MALLOC/FREE/REALLOC: THE THREAD CACHE, THEN THE OWNER ARENA UNDER ITS LOCK         *
+ *        8. CALLOC: ALLOCATE A BLOCK SET TO ZERO, SKIPPING THE BYTES KNOWN TO READ ZERO        *
+ * 9. MM_FREE_SIZED: FREE A BLOCK OF A KNOWN REQUEST SIZE THROUGH THE CACHE WITHOUT ITS HEADER  *
+ * 10. MM_MALLOC_BATCH/MM_FREE_BATCH: MANY BLOCKS AT ONCE, SPLIT FROM ONE RUN OR COALESCED ONCE *
+ *   11. MM_MALLOC_USABLE_SIZE/MM_GOOD_SIZE: WHAT A BLOCK HOLDS AND WHAT A REQUEST WOULD GET    *
+ *   12. MM_MEMALIGN/ALIGNED_ALLOC/POSIX_MEMALIGN: A BLOCK WHOSE PAYLOAD STARTS ON A BOUNDARY   *
+ *  13. MM_MALLOC_CLASS: MALLOC FOR A CONSTANT SIZE WHOSE CACHE BIN WAS FOLDED AT COMPILE TIME  *
+ *    14. MM_FIT_POLICY: THE FIT A SIZE CLASS USES NOW, PICKED BY FIT_REVIEW FROM ITS WINDOW    *
+ ************************************************************************************************/
 
 /*
  * mm_init: returns false on error, true on success.
@@ -335,201 +2136,341 @@ static void coalesce(void* block) {
 bool mm_init(void)
 {
     // IMPLEMENT THIS
-    void* heap = mem_sbrk(INIT_SIZE);
-    if (heap == (void *)-1) {
-        return false;
+    // the other arenas belong to the old heap: empty them and make every thread pick again
+    __atomic_fetch_add(&heap_epoch, 1, __ATOMIC_RELEASE);
+    for (int arena = 1; arena < MEM_MAX_ARENAS; arena++) {
+        mm_arena_reset(arena);
     }
-    mm_memset(heap, 0, heap_size);
-    heap_size = mm_heapsize();
-    
-    
-    set (heap, 0);
-    set (heap + headerORFooter_SIZE, 0x11);        // set prologue header
-    set (heap + 2 * headerORFooter_SIZE, 0x11);    // set prologue footer
-    set (heap + 3 * headerORFooter_SIZE, 0x1);       //set epilogue header
-    // Initialize all free lists to NULL
-    for (int i = 0; i < NUM_FREE_LISTS; i++) {
-        free_lists[i] = NULL;
+    if (!arena_init(0)) {
+        return false;
     }
+    // the calling thread is the first one and gets the main heap
+    ctl->num_threads = 1;
+    ctl->tcache_count = opt_tcache_count;
+    home = ctl;
+    thread_epoch = heap_epoch;
+    tcache = tcache_create();
     return true;
 }
 
 /*
- * malloc : returns a pointer to the allocated memory
+ * mm_mallopt: set a tunable (MM_OPT_* in mm.h). It takes effect at the next mm_init.
+ * returns false if the parameter or the value is not valid.
  */
-void* malloc(size_t size)
+bool mm_mallopt(int param, int value)
+{
+    switch (param) {
+    case MM_OPT_POLICY:
+        if (value != MM_POLICY_SEGLIST && value != MM_POLICY_TLSF) {
+            return false;
+        }
+        opt_policy = value;
+        return true;
+    case MM_OPT_SLAB_MAX:
+        if (value < 0 || value > SLAB_MAX_SIZE) {
+            return false;
+        }
+        opt_slab_max = value;
+        return true;
+    case MM_OPT_TCACHE_COUNT:
+        if (value < 0 || value > TCACHE_MAX_COUNT) {
+            return false;
+        }
+        opt_tcache_count = value;
+        return true;
+    case MM_OPT_MMAP_THRESHOLD:
+        if (value < 0) {
+            return false;
+        }
+        opt_mmap_threshold = value;
+        return true;
+    case MM_OPT_TRIM_THRESHOLD:
+        if (value < 0) {
+            return false;
+        }
+        opt_trim_threshold = value;
+        return true;
+    case MM_OPT_PURGE_THRESHOLD:
+        if (value < 0) {
+            return false;
+        }
+        opt_purge_threshold = value;
+        return true;
+    case MM_OPT_GROW_MAX:
+        if (value < 0) {
+            return false;
+        }
+        opt_grow_max = value;
+        return true;
+    case MM_OPT_QUICK_BUDGET:
+        if (value < 0) {
+            return false;
+        }
+        opt_quick_budget = value;
+        return true;
+    case MM_OPT_LAYOUT:
+        if (value != MM_LAYOUT_WIDE && value != MM_LAYOUT_COMPACT) {
+            return false;
+        }
+        opt_layout = value;
+        return true;
+    case MM_OPT_FIT_ADAPT:
+        if (value != 0 && value != 1) {
+            return false;
+        }
+        opt_fit_adapt = value;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * mm_trim: give the free tail of every heap back to memlib, keeping at least pad bytes
+ * of it for the requests to come. returns true if any memory was released.
+ */
+bool mm_trim(size_t pad)
+{
+    bool trimmed = false;
+    for (int arena = 0; arena < MEM_MAX_ARENAS; arena++) {
+        if (mm_arena_size(arena) == 0) {
+            continue;
+        }
+        ctl = arena_ctl(arena);
+        spin_lock(&ctl->lock);
+        remote_drain();
+        quick_consolidate();    // a quick-listed block may be all that keeps the tail from being free
+        trimmed |= arena_trim(pad);
+        spin_unlock(&ctl->lock);
+    }
+    ctl = home;
+    return trimmed;
+}
+
+/*
+ * arena_malloc : returns a pointer to the allocated memory, from the heap of ctl
+ */
+static void* arena_malloc(size_t size)
     {
         mm_checkheap(__LINE__);
+        ctl->mallocs++;
+        if (ctl->fit == NULL && ctl->fit_adapt && !ctl->tlsf && mm_arena_size(ctl->arena) >= FIT_HEAP_MIN) {
+            fit_create();
+        }
+        ctl->zero_lo = ctl->zero_hi = 0;
+        // small requests get a headerless slot from the slab of their size class
+        if (size <= ctl->slab_max) {
+            void* slot = slab_malloc(size);
+            if (slot != NULL) {
+                return slot;
+            }
+        }
+
         // Align the requested size: the minimum for a free block is 24 bytes,
         // so I set the minimum size for an allocated block to be 32 bytes(plus the size of metadata).
         // This way, the payload will be 16-byte aligned.
 
         size = alignx(size);
 
-        // Traverse the free lists to find a suitable free block
-        // First fit strategy is used
-        for (int i = get_free_list_index(size); i < NUM_FREE_LISTS; i++) {
-            int* fb = free_lists[i];
+        // a block of exactly this size that was freed recently
+        void* quick = quick_get(size);
+        if (quick != NULL) {
+            return quick;
+        }
 
-            while (fb != NULL) {
-                size_t free_size = extract_size(fb);
-                if (free_size >= size) {
-                // found the first free block that is large enough
-                
-                // check if the block can be split -> the remaining size can be marked as free block
-                if (free_size >= size + 4 * headerORFooter_SIZE) {
-                    // split the block
-                    //                   next_block = (char*)fb + free_size + headerORFooter_SIZE                
-                        //                                                                       │                   
-                        //                                                                       │                   
-                        //                                           free_size                   │                   
-                        //                        ◄─────────────────────────────────────────────►│                   
-                        //                         alignx(size)                                  │                  ┼
-                        //                        ◄─────────►                                    │                   
-                        //                                  │                                    ▼                   
-                        //                   ┌────┬─────────┼────┬────┬────┬────────────────┬────┬────┐              
-                        // Malloc(size)      │    │         │Head│Prev│Next│    Payload     │Foot│    │              
-                        //                   └────┴─────────┼────┴────┴────┴────────────────┴────┴────┘              
-                        //                   ▲              │            remaining size                              
-                        //                   │                 ◄─────────────────────────────────►                   
-                        //                free_block                                                                 
-                        //                  (fb)                                                                     
-
-                    remove_from_free_list(fb);
-
-                    // set the header for the allocated part
-                    set(fb, (size << 1 | 0x01) <<1 | extract_prev_is_free(fb));    
-
-                    // set the header and footer for the remaining part
-                    size_t remaining_size = free_size - size - headerORFooter_SIZE;
-                    set((char*)fb + size + headerORFooter_SIZE, (remaining_size << 1) << 1 | 0x01);
-                    set((char*)fb + free_size, (remaining_size << 1) << 1 | 0x01);
-                    add_to_free_list((char*)fb + size + headerORFooter_SIZE);
-
-                    // update the next block after the old free block's prev_is_free bit
-                    if ((char*)fb + free_size + headerORFooter_SIZE < (char*)mem_heap_hi() - 7) {
-                        //the next block is not the epilogue block 
-                        void* next_block = (char*)fb + free_size + headerORFooter_SIZE;
-                        if (extract_curr_is_free(next_block) == 0) {
-                            set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 0);
-                            set(next_block + extract_size(next_block), ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 0);
-                        }
-                        else{
-                            set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 0);
-                        }
-                    }
-                    
+        // Ask the free-block index of the current policy for a suitable free block,
+        // with the quick lists consolidated first if that finds nothing
+        int* fb = find_fit(size);
+        if (fb == NULL && ctl->quick_bytes != 0) {
+            quick_consolidate();
+            fb = find_fit(size);
+        }
+        if (fb != NULL) {
+            size_t free_size = extract_size(fb);
+            // found a free block that is large enough
+            // if it reads zero, so does the block taken from it, apart from the old links (and footer)
+            bool zero = extract_zero(fb);
+            if (zero) {
+                ctl->zero_lo = ZERO_SKIP;
+                ctl->zero_hi = free_size - headerORFooter_SIZE;
+            }
+            
+            // check if the block can be split -> the remaining size can be marked as free block
+            if (free_size >= size + headerORFooter_SIZE + ctl->split_min) {
+                if (ctl->fit != NULL && get_free_list_index(size) != LARGE_TREE_CLASS &&
+                    ctl->fit[get_free_list_index(size)].splits < UINT16_MAX) {
+                    ctl->fit[get_free_list_index(size)].splits++;
                 }
-                else{
-                    // the block cannot be split
-                    // allocate the whole block
-                    remove_from_free_list((char*)fb);
-
-                    // set the header
-                    set((char*)fb, (free_size << 1 | 0x01)<<1 | extract_prev_is_free(fb));
-
-                    // set the next block's prev_is_free bit(everything else stays the same)
-                    if ((char*)fb + free_size + headerORFooter_SIZE < (char*)mem_heap_hi() - 7) {
-                        //the next block is not the epilogue block
-                        void* next_block = (char*)fb + free_size + headerORFooter_SIZE;
-                        if (extract_curr_is_free(next_block) == 0) {
-                            set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 1);
-                            set(next_block + extract_size(next_block), ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 1);
-                        }
-                        else{
-                            set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 1);
-                        }
+                // split the block
+                //                   next_block = (char*)fb + free_size + headerORFooter_SIZE                
+                    //                                                                       │                   
+                    //                                                                       │                   
+                    //                                           free_size                   │                   
+                    //                        ◄─────────────────────────────────────────────►│                   
+                    //                         alignx(size)                                  │                  ┼
+                    //                        ◄─────────►                                    │                   
+                    //                                  │                                    ▼                   
+                    //                   ┌────┬─────────┼────┬────┬────┬────────────────┬────┬────┐              
+                    // Malloc(size)      │    │         │Head│Prev│Next│    Payload     │Foot│    │              
+                    //                   └────┴─────────┼────┴────┴────┴────────────────┴────┴────┘              
+                    //                   ▲              │            remaining size                              
+                    //                   │                 ◄─────────────────────────────────►                   
+                    //                free_block                                                                 
+                    //                  (fb)                                                                     
+
+                remove_from_free_list(fb);
+
+                // set the header for the allocated part
+                set(fb, (size << 1 | 0x01) <<1 | extract_prev_bits(fb));    
+
+                // set the header and footer for the remaining part
+                size_t remaining_size = free_size - size - headerORFooter_SIZE;
+                set((char*)fb + size + headerORFooter_SIZE, (remaining_size << 1) << 1 | 0x01);
+                set((char*)fb + free_size, (remaining_size << 1) << 1 | 0x01);
+                add_to_free_list((char*)fb + size + headerORFooter_SIZE);
+                if (zero) {
+                    set_zero((char*)fb + size + headerORFooter_SIZE);
+                    ctl->zero_hi = size;    // the rest starts with its own header
+                }
+
+                // update the next block after the old free block's prev_is_free bit
+                if ((char*)fb + free_size + headerORFooter_SIZE < (char*)heap_hi() - 7) {
+                    //the next block is not the epilogue block 
+                    void* next_block = (char*)fb + free_size + headerORFooter_SIZE;
+                    if (extract_curr_is_free(next_block) == 0) {
+                        set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 0);
+                        set(next_block + extract_size(next_block), ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 0);
+                    }
+                    else{
+                        set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 0);
                     }
+                    set_prev_min(next_block, remaining_size == MIN_BLOCK_COMPACT);
                 }
+                
+            }
+            else{
+                // the block cannot be split
+                // allocate the whole block
+                remove_from_free_list((char*)fb);
 
-                return (char*) fb + headerORFooter_SIZE ;    // return the payload
-                }
-                fb = extract_next_free_blk(fb);
-            }
-        }
-        // no suitable free block found, expand the heap
-        size_t block_size = size + headerORFooter_SIZE;
-        //check if the last block in the heap is free
-        //Go to the last block's footer. If the last block is allocated, extracting its size will not make any sense.
-        void*last_block = mm_heap_hi() - 7 - 8;
-        size_t last_block_size = extract_size(last_block);
-        void* last_block_start = last_block - last_block_size; //This value is not valid if the last block is allocated!!!!!!!!!!!
-        bool is_in_free_list = 1;
-        //check if the footer and header are the same and last_block_start in the free list
-        //also need to check if last_block_start is a valid block in the heap to avoid segmentation fault.
-        if(last_block_start >= mm_heap_lo() + 3 * headerORFooter_SIZE && last_block_start < mm_heap_hi() - 7 && last_block_start + last_block_size == last_block){
-            if (extract_curr_is_free(last_block) == 0 && extract_size(last_block) == extract_size(last_block_start) && extract_prev_is_free(last_block_start) == 0){
-            // check if the last block is in the free list
-            size_t size = extract_size(last_block_start);
-            int list_index = get_free_list_index(size);
-            for (int i = list_index; i < NUM_FREE_LISTS; i++) {
-                int* fb = free_lists[i];
-                while (fb != NULL) {
-                    if (fb == last_block_start) {
-                        is_in_free_list = 0;
-                        break;
+                // set the header
+                set((char*)fb, (free_size << 1 | 0x01)<<1 | extract_prev_bits(fb));
+
+                // set the next block's prev_is_free bit(everything else stays the same)
+                if ((char*)fb + free_size + headerORFooter_SIZE < (char*)heap_hi() - 7) {
+                    //the next block is not the epilogue block
+                    void* next_block = (char*)fb + free_size + headerORFooter_SIZE;
+                    if (extract_curr_is_free(next_block) == 0) {
+                        set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 1);
+                        set(next_block + extract_size(next_block), ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 1);
+                    }
+                    else{
+                        set(next_block, ((extract_size(next_block) << 1) | extract_curr_is_free(next_block)) << 1 | 1);
                     }
-                    fb = extract_next_free_blk(fb);
-                }
-                // break the outer loop if the block is found in the free list to increase efficiency
-                if (is_in_free_list) {
-                    break;
                 }
             }
-        }
-        }
-        // allocate the new block
-        void* new_block = mem_sbrk(block_size) - headerORFooter_SIZE;
-        if (new_block == (void *)-1) {
-            return NULL; // error in expanding heap
-        }
-
-        // check if the heap is empty currently;
-        if (mm_heapsize() == 32){
-            // if the heap is empty, set the prev_is_free bit of the new block to 1 because the prologue is not free
-            set(new_block, ((size << 1 | 0x01)<<1 )| 0x1);
-            // update the epilogue header
-            set(new_block + block_size, 0x1);
-        }else{
-            // if the heap is not empty, set the prev_is_free bit of the new block to current last block's free bit
-            set(new_block, ((size << 1 | 0x01)<<1 )| (is_in_free_list));
-            set(new_block + block_size, 0x1);
 
+            return (char*) fb + headerORFooter_SIZE ;    // return the payload
         }
-        heap_size = mm_heapsize();
-        void* ret = new_block + headerORFooter_SIZE;
-        return ret;
+        // no suitable free block found: a large request gets a mapping of its own, so
+        // freeing it gives the memory back at once; anything else expands the heap
+        if (ctl->mmap_threshold != 0 && size >= ctl->mmap_threshold) {
+            ctl->zero_hi = SIZE_MAX;    // fresh pages
+            return mmap_malloc(size, ALIGNMENT);
+        }
+        return grow_heap(size);
     }
 /*
- * free
+ * arena_free : gives the block or slot back to the heap of ctl, which owns it
  */
-void free(void* ptr)
+static void arena_free(void* ptr)
 {
     mm_checkheap(__LINE__);
     // IMPLEMENT THIS
+    // a slot has no header, the page map tells it apart from a block
+    slab_t* slab = slab_of(ptr);
+    if (slab != NULL) {
+        slab_free(slab, ptr);
+        return;
+    }
     void* block = ptr - headerORFooter_SIZE;
+    void* block_end = block + extract_size(block) + headerORFooter_SIZE;
+    // a free neighbor that reads zero is not purged again below, but the block stays zero
+    bool prev_zero = false;
+    bool next_zero = false;
+    if (ctl->purge_threshold != 0) {
+        prev_zero = extract_prev_is_free(block) == 0 && extract_zero(prev_free_block(block));
+        next_zero = block_end < heap_hi() - 7 && extract_curr_is_free(block_end) == 0 && extract_zero(block_end);
+    }
     // mark the block's metadata as free
-    set(block, ((extract_size(block) << 1 ) << 1) | extract_prev_is_free(block) );
-    set(block + extract_size(block), ((extract_size(block) << 1 ) << 1) | extract_prev_is_free(block) );
-    coalesce(block);
-
+    set(block, ((extract_size(block) << 1 ) << 1) | extract_prev_bits(block) );
+    set(block + extract_size(block), ((extract_size(block) << 1 ) << 1) | extract_prev_bits(block) );
+    void* freed = block;
+    block = coalesce(block);
+
+    // a large free tail goes back to memlib, the pages inside any other large free block
+    // are decommitted (trimming first, so the tail is not purged and then given back).
+    // A free neighbor that was large already had its pages purged, so only the block just
+    // freed and the small neighbors it merged with are, which keeps repeated frees cheap
+    void* merged_end = block + extract_size(block) + headerORFooter_SIZE;
+    bool is_last = merged_end == heap_hi() - 7;
+    if (is_last && ctl->trim_threshold != 0 && extract_size(block) >= ctl->trim_threshold) {
+        arena_trim(0);
+    }
+    if (ctl->purge_threshold != 0 && extract_size(block) >= ctl->purge_threshold) {
+        void* lo = (size_t)(freed - block) < ctl->purge_threshold ? block : freed;
+        void* hi = (size_t)(merged_end - block_end) < ctl->purge_threshold ? merged_end : block_end;
+        purge_block(block, lo, hi);
+        // the block reads zero if the parts left out read zero already: their header,
+        // links and footer inside the merged (and maybe trimmed) block are cleared for it
+        if ((lo == block || prev_zero) && (hi == merged_end || next_zero)) {
+            // (a compact block freed in front of a large one leaves its header in the links)
+            void* first = block + 4 * headerORFooter_SIZE;
+            void* end = block + extract_size(block);
+            if (lo != block && freed - headerORFooter_SIZE < end) {
+                set(freed - headerORFooter_SIZE, 0);
+            }
+            if (hi != merged_end) {
+                void* from = block_end > first ? block_end : first;
+                void* to = block_end + 4 * headerORFooter_SIZE < end ? block_end + 4 * headerORFooter_SIZE : end;
+                if (from < to) {
+                    memset(from, 0, to - from);
+                }
+            }
+            set_zero(block);
+        }
+    }
     return;
 }
 
 /*
- * realloc
+ * arena_realloc : resizes a block or slot of the heap of ctl, which owns it
  */
-void* realloc(void* oldptr, size_t size)
+static void* arena_realloc(void* oldptr, size_t size)
 {
     mm_checkheap(__LINE__);
     // IMPLEMENT THIS
     if (oldptr == NULL) {
-        return malloc(size);
+        return arena_malloc(size);
     }
     if (size == 0) {
-        free(oldptr);
+        arena_free(oldptr);
         return NULL;
     }
+    slab_t* slab = slab_of(oldptr);
+    if (slab != NULL) {
+        // a slot cannot grow, move it unless the new size still fits
+        if (size <= slab->slot_size) {
+            return oldptr;
+        }
+        void* newptr = arena_malloc(size);
+        if (newptr == NULL) {
+            return NULL;
+        }
+        mm_memcpy(newptr, oldptr, slab->slot_size);
+        arena_free(oldptr);
+        return newptr;
+    }
     void* old_block = oldptr - headerORFooter_SIZE;
     size_t old_size = extract_size(old_block);
     if (old_size > alignx(size)) {
@@ -537,16 +2478,16 @@ void* realloc(void* oldptr, size_t size)
         if (old_size >= alignx(size) + 32 + 24) {
             // the old block can be split
             // set the header for the allocated part
-            set(old_block, (alignx(size) << 1 | 0x01) << 1 | extract_prev_is_free(old_block));
+            set(old_block, (alignx(size) << 1 | 0x01) << 1 | extract_prev_bits(old_block));
 
             // set the header and footer for the remaining part (free)
             size_t remaining_size = old_size - alignx(size) - headerORFooter_SIZE;
             set(old_block + alignx(size) + headerORFooter_SIZE, (remaining_size << 1) << 1 | 0x01);
             set(old_block + old_size, (remaining_size << 1) << 1 | 0x01);
-            free(old_block + alignx(size) + 2 * headerORFooter_SIZE);
+            arena_free(old_block + alignx(size) + 2 * headerORFooter_SIZE);
 
             // update prev_is_free bit of the next block
-            if (old_block + alignx(size) + 2 * headerORFooter_SIZE + extract_size(old_block + alignx(size) + headerORFooter_SIZE) < mem_heap_hi() - 7) {
+            if (old_block + alignx(size) + 2 * headerORFooter_SIZE + extract_size(old_block + alignx(size) + headerORFooter_SIZE) < heap_hi() - 7) {
                 void* next_block1 = old_block + alignx(size) + 2 * headerORFooter_SIZE + extract_size(old_block + alignx(size) + headerORFooter_SIZE);
                 if (extract_curr_is_free(next_block1) == 0) {
                     set(next_block1, ((extract_size(next_block1) << 1) | extract_curr_is_free(next_block1)) << 1 | 0);
@@ -596,16 +2537,17 @@ void* realloc(void* oldptr, size_t size)
 
                 remove_from_free_list(next_block);
 
-                set(old_block, ((alignx(size) << 1) | 0x01) << 1 | extract_prev_is_free(old_block));
+                set(old_block, ((alignx(size) << 1) | 0x01) << 1 | extract_prev_bits(old_block));
 
                 // set the header and footer for the remaining part (free)
                 set((char*)old_block + alignx(size) + headerORFooter_SIZE, ((remaining_size - 8) << 1) << 1 | 0x01);
                 set((char*)old_block + alignx(size) + remaining_size, ((remaining_size - 8) << 1) << 1 | 0x01);
-                free(old_block + alignx(size) + 2 * headerORFooter_SIZE);
+                arena_free(old_block + alignx(size) + 2 * headerORFooter_SIZE);
 
                 // update prev_is_free bit of the next block
-                if (old_block + alignx(size) + extract_size(old_block + alignx(size)) + 2* headerORFooter_SIZE < mem_heap_hi() - 7) {
-                    void* next_block1 = old_block + alignx(size) + extract_size(old_block + alignx(size)) + 2* headerORFooter_SIZE;
+                // (the size comes from the remaining free block's header; the allocated part has no footer)
+                if (old_block + alignx(size) + extract_size(old_block + alignx(size) + headerORFooter_SIZE) + 2* headerORFooter_SIZE < heap_hi() - 7) {
+                    void* next_block1 = old_block + alignx(size) + extract_size(old_block + alignx(size) + headerORFooter_SIZE) + 2* headerORFooter_SIZE;
                     if (extract_curr_is_free(next_block1) == 0) {
                         set(next_block1, ((extract_size(next_block1) << 1) | extract_curr_is_free(next_block1)) << 1 |0);
                         set(next_block1 + extract_size(next_block1), ((extract_size(next_block1) << 1) | extract_curr_is_free(next_block1)) << 1 | 0);
@@ -639,10 +2581,10 @@ void* realloc(void* oldptr, size_t size)
                 
                 remove_from_free_list(next_block);
                 
-                set(old_block, ((extract_size(old_block) + extract_size(next_block) + headerORFooter_SIZE) << 1 | 0x01) << 1 | extract_prev_is_free(old_block));    
+                set(old_block, ((extract_size(old_block) + extract_size(next_block) + headerORFooter_SIZE) << 1 | 0x01) << 1 | extract_prev_bits(old_block));    
 
                 // update prev_is_free bit of the next block
-                if (old_block + extract_size(old_block) + headerORFooter_SIZE < mem_heap_hi() - 7) {
+                if (old_block + extract_size(old_block) + headerORFooter_SIZE < heap_hi() - 7) {
                     void* next_block1 = old_block + extract_size(old_block) + headerORFooter_SIZE;
                     if (extract_curr_is_free(next_block1) == 0) {
                         set(next_block1, ((extract_size(next_block1) << 1) | extract_curr_is_free(next_block1)) << 1 | 1);
@@ -657,42 +2599,526 @@ void* realloc(void* oldptr, size_t size)
                 }
                 
         } else {
+            // the block ends at the epilogue, or only a free block too small to absorb lies
+            // between them: ask memlib for just the missing bytes and grow the block in place
+            void* epilogue = heap_hi() - 7;
+            bool absorb_next = next_block != epilogue && extract_curr_is_free(next_block) == 0 &&
+                next_block + extract_size(next_block) + headerORFooter_SIZE == epilogue;
+            size_t have = old_size + (absorb_next ? extract_size(next_block) + headerORFooter_SIZE : 0);
+            if ((next_block == epilogue || absorb_next) && heap_sbrk(alignx(size) - have) != (void *)-1) {
+                if (absorb_next) {
+                    remove_from_free_list(next_block);
+                }
+                set(old_block, ((alignx(size) << 1) | 0x01) << 1 | extract_prev_bits(old_block));
+                set(old_block + alignx(size) + headerORFooter_SIZE, 0x1);    // set epilogue header
+                return oldptr;
+            }
+            // the previous block is free: merge with it (and with a free next block if that
+            // is still not enough) and slide the payload down to the start of the merged block
+            if (extract_prev_is_free(old_block) == 0) {
+                void* prev_block = prev_free_block(old_block);
+                size_t prev_size = old_block - prev_block - headerORFooter_SIZE;
+                bool merge_next = next_block != epilogue && extract_curr_is_free(next_block) == 0;
+                size_t total = prev_size + headerORFooter_SIZE + old_size +
+                    (merge_next ? extract_size(next_block) + headerORFooter_SIZE : 0);
+                if (total >= alignx(size)) {
+                    // the free blocks hold their links in what becomes the payload, unlink them first
+                    remove_from_free_list(prev_block);
+                    if (merge_next) {
+                        remove_from_free_list(next_block);
+                    }
+                    mm_memmove(prev_block + headerORFooter_SIZE, oldptr, old_size);
+                    if (total >= alignx(size) + 4 * headerORFooter_SIZE) {
+                        // split, the rest is freed (and coalesced with what follows it)
+                        set(prev_block, ((alignx(size) << 1) | 0x01) << 1 | extract_prev_bits(prev_block));
+                        void* rest = prev_block + alignx(size) + headerORFooter_SIZE;
+                        set(rest, ((total - alignx(size) - headerORFooter_SIZE) << 1 | 0x01) << 1 | 0x1);
+                        arena_free(rest + headerORFooter_SIZE);
+                    }
+                    else {
+                        // take it all, the block after it now follows an allocated block
+                        set(prev_block, ((total << 1) | 0x01) << 1 | extract_prev_bits(prev_block));
+                        void* after = prev_block + total + headerORFooter_SIZE;
+                        if (after < heap_hi() - 7) {
+                            set(after, ((extract_size(after) << 1) | extract_curr_is_free(after)) << 1 | 1);
+                        }
+                    }
+                    return prev_block + headerORFooter_SIZE;
+                }
+            }
             // the next block is free but the remaining part cannot be marked as free block
             // reallocate the whole free block
-            void* newptr = malloc(size);
+            void* newptr = arena_malloc(size);
             if (newptr == NULL) {
                 return NULL;  // malloc failed
             }
             mm_memcpy(newptr, oldptr, old_size);  // copy the old data
-            memset((char*)newptr + old_size, 0, alignx(size) - old_size);  // set the other bytes to 0
-            mm_free(oldptr);
+            memset((char*)newptr + old_size, 0, size - old_size);  // set the other bytes to 0 (the new block may be a slot)
+            arena_free(oldptr);
             return newptr;
         }
     }
 }
 
+/**********************************************************
+ *             HELPER FUNCTION: FREE_TO_OWNER             *
+ * CTL IS THE ARENA OF THE BLOCK (OR SLOT): FREE IT UNDER *
+ *  THE LOCK IF THAT IS THE THREAD'S OWN ARENA, INTO ITS  *
+ * QUICK LISTS IF THEY TAKE IT, OR PUSH IT ON THE REMOTE  *
+ *            STACK OF THE OWNER IF IT IS NOT             *
+ **********************************************************/
+static void free_to_owner(void* ptr) {
+    heap_ctl_t* arena = ctl;
+    if (arena != home) {
+        remote_push(arena, ptr);
+        return;
+    }
+    spin_lock(&arena->lock);
+    remote_drain();
+    if (!quick_put(ptr)) {
+        arena_free(ptr);
+    }
+    spin_unlock(&arena->lock);
+}
+
+/*
+ * malloc : returns a pointer to the allocated memory
+ * from the thread's cache if it has a block of the right size, else from the thread's arena
+ */
+void* malloc(size_t size)
+{
+    thread_enter();
+    void* ptr = tcache_get(size);
+    if (ptr != NULL) {
+        return ptr;
+    }
+    heap_ctl_t* arena = ctl;
+    spin_lock(&arena->lock);
+    remote_drain();
+    ptr = arena_malloc(size);
+    spin_unlock(&arena->lock);
+    return ptr;
+}
+
+/*
+ * mm_malloc_class : malloc for a request whose thread cache bin is already known,
+ * called by MM_MALLOC of mm_inline.h when the size is a compile-time constant
+ */
+void* mm_malloc_class(size_t size, int bin)
+{
+    thread_enter();
+    void* ptr = NULL;
+    if (tcache != NULL && size > ctl->slab_max) {
+        dbg_assert(bin == tcache_bin(alignx(size)));
+        ptr = tcache_pop(bin);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    heap_ctl_t* arena = ctl;
+    spin_lock(&arena->lock);
+    remote_drain();
+    ptr = arena_malloc(size);
+    spin_unlock(&arena->lock);
+    return ptr;
+}
+
+/*
+ * free
+ * into the thread's cache if there is room, else back to the arena that owns the block:
+ * directly if that is the thread's own arena, through its remote stack if it is not
+ */
+void free(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    if (is_mapped(ptr)) {
+        mmap_free(ptr);
+        return;
+    }
+    thread_enter();
+    ctl = arena_ctl(mm_arena_of(ptr));
+    // the page map and the block header are read without the owner's lock. The owner may
+    // flip the prev bit of the header under its lock, but the size bits never change while
+    // the block is allocated
+    if (slab_of(ptr) == NULL) {
+        size_t size = (__atomic_load_n((size_t*)(ptr - headerORFooter_SIZE), __ATOMIC_RELAXED) >> 2) & ~(size_t)0x7;
+        if (tcache_put(ptr, size)) {
+            return;
+        }
+    }
+    free_to_owner(ptr);
+}
+
+/*
+ * mm_free_sized : frees a block the caller knows the requested size of
+ * The address tells a mapping from a heap block, whatever the size. In a heap, a size above
+ * the slab limit rounded up to 16 is never a slot (realloc keeps a slot while the size fits
+ * it), so neither the page map nor the header is read: the thread cache files the block
+ * under the class of alignx(size). The block itself may be larger (realloc kept it, or it
+ * took a free block too small to split), the cache only promises at least the class size
+ */
+void mm_free_sized(void* ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    int arena = mm_arena_of(ptr);
+    if (arena < 0) {
+        mmap_free(ptr);
+        return;
+    }
+    thread_enter();
+    ctl = arena_ctl(arena);
+    if (size <= align(ctl->slab_max)) {
+        free(ptr);
+        return;
+    }
+    dbg_assert(slab_of(ptr) == NULL && extract_curr_is_free(ptr - headerORFooter_SIZE) == 1);
+    dbg_assert(extract_size(ptr - headerORFooter_SIZE) >= alignx(size));
+    if (tcache_put(ptr, alignx(size))) {
+        return;
+    }
+    free_to_owner(ptr);
+}
+
+/*
+ * realloc
+ * the block stays in (or moves within) the arena that owns it
+ */
+void* realloc(void* oldptr, size_t size)
+{
+    if (oldptr == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(oldptr);
+        return NULL;
+    }
+    thread_enter();
+    if (is_mapped(oldptr)) {
+        // keep the mapping while the block still fits it and is still large, else move
+        size_t old_size = extract_size(oldptr - headerORFooter_SIZE);
+        if (size <= old_size && ctl->mmap_threshold != 0 && size >= ctl->mmap_threshold) {
+            return oldptr;
+        }
+        // a block that grows and stays large keeps a mapping, whose pages move without a copy
+        if (ctl->mmap_threshold != 0 && size >= ctl->mmap_threshold && size < SIZE_MAX / 2) {
+            void* newptr = mmap_realloc(oldptr, size);
+            if (newptr != NULL) {
+                return newptr;
+            }
+        }
+        void* newptr = malloc(size);
+        if (newptr == NULL) {
+            return NULL;
+        }
+        mm_memcpy(newptr, oldptr, size < old_size ? size : old_size);
+        mmap_free(oldptr);
+        return newptr;
+    }
+    heap_ctl_t* arena = arena_ctl(mm_arena_of(oldptr));
+    ctl = arena;
+    spin_lock(&arena->lock);
+    void* newptr = arena_realloc(oldptr, size);
+    spin_unlock(&arena->lock);
+    return newptr;
+}
+
 /*
  * calloc
- * ThisHelper function is not tested by mdriver, and has been implemented for you.
+ * like malloc, but only the bytes arena_malloc does not know to read zero are cleared:
+ * fresh heap or mapped pages and free blocks marked zero (purged or grown) are skipped
  */
 void* calloc(size_t nmemb, size_t size)
 {
-    void* ptr;
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        return NULL;
+    }
     size *= nmemb;
-    ptr = malloc(size);
-    if (ptr) {
+    thread_enter();
+    void* ptr = tcache_get(size);
+    if (ptr != NULL) {
         memset(ptr, 0, size);
+        return ptr;
+    }
+    heap_ctl_t* arena = ctl;
+    spin_lock(&arena->lock);
+    remote_drain();
+    ptr = arena_malloc(size);
+    size_t zero_lo = ctl->zero_lo;
+    size_t zero_hi = ctl->zero_hi;
+    spin_unlock(&arena->lock);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    zero_hi = zero_hi < size ? zero_hi : size;
+    if (zero_lo >= zero_hi) {
+        memset(ptr, 0, size);
+    }
+    else {
+        memset(ptr, 0, zero_lo);
+        memset(ptr + zero_hi, 0, size - zero_hi);
+    }
+    return ptr;
+}
+
+/*
+ * mm_malloc_batch : allocates n blocks of size bytes into out, returns how many it allocated
+ * The blocks are split off one run of n blocks that is taken from the arena like a single
+ * request, under one lock. A run is kept below the mmap threshold (a larger batch takes
+ * several runs), and slab-sized or mapped requests are allocated one by one
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void** out)
+{
+    thread_enter();
+    heap_ctl_t* arena = ctl;
+    spin_lock(&arena->lock);
+    remote_drain();
+    size_t block_size = alignx(size);
+    size_t per_run = n;
+    if (size <= ctl->slab_max) {
+        per_run = 1;
+    }
+    else if (ctl->mmap_threshold != 0 && per_run > (ctl->mmap_threshold + headerORFooter_SIZE - 1) / (block_size + headerORFooter_SIZE)) {
+        per_run = (ctl->mmap_threshold + headerORFooter_SIZE - 1) / (block_size + headerORFooter_SIZE);
+    }
+    if (per_run == 0) {
+        per_run = 1;
+    }
+    size_t done = 0;
+    while (done < n) {
+        size_t count = n - done < per_run ? n - done : per_run;
+        // a run that no free block fits is halved, down to single blocks, before the heap grows for it
+        while (count > 1 && probe_fit(count * (block_size + headerORFooter_SIZE) - headerORFooter_SIZE) == NULL) {
+            count /= 2;
+        }
+        if (count == 1) {
+            void* ptr = arena_malloc(size);
+            if (ptr == NULL) {
+                break;
+            }
+            out[done++] = ptr;
+            continue;
+        }
+        // the run is one allocated block as long as the count blocks and their headers
+        void* run = arena_malloc(count * (block_size + headerORFooter_SIZE) - headerORFooter_SIZE);
+        if (run == NULL) {
+            break;
+        }
+        ctl->mallocs += count - 1;
+        // cut it into blocks in one pass: only the first keeps the bits of the block before the run,
+        // and the last one takes whatever the run got beyond the request (a free block too small to split)
+        void* block = run - headerORFooter_SIZE;
+        void* run_end = block + extract_size(block);
+        int prev_bits = extract_prev_bits(block);
+        for (size_t i = 0; i < count; i++) {
+            size_t this_size = i == count - 1 ? (size_t)(run_end - block) : block_size;
+            set(block, ((this_size << 1) | 0x01) << 1 | prev_bits);
+            prev_bits = 1;
+            out[done++] = block + headerORFooter_SIZE;
+            block += this_size + headerORFooter_SIZE;
+        }
+    }
+    spin_unlock(&arena->lock);
+    return done;
+}
+
+/************************************************
+ *      HELPER FUNCTION: COMPARE_ADDRESSES      *
+ * QSORT ORDER OF A POINTER ARRAY, LOWEST FIRST *
+ ************************************************/
+static int compare_addresses(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)*(void* const*)a;
+    uintptr_t y = (uintptr_t)*(void* const*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * mm_free_batch : frees the n blocks of ptrs (sorted in place by address)
+ * The thread's own arena is locked once for all of its blocks, and blocks that lie next to
+ * each other are joined into one allocated block first, so a run of them is coalesced once.
+ * The blocks of each other arena are linked into one chain and pushed on its remote stack
+ * with a single compare-and-swap, its owner frees them at its next drain. The thread cache
+ * and quick lists are skipped
+ */
+void mm_free_batch(void** ptrs, size_t n)
+{
+    qsort(ptrs, n, sizeof(void*), compare_addresses);
+    thread_enter();
+    size_t i = 0;
+    while (i < n) {
+        if (ptrs[i] == NULL) {
+            i++;
+            continue;
+        }
+        if (is_mapped(ptrs[i])) {
+            mmap_free(ptrs[i++]);
+            continue;
+        }
+        // sorted, the blocks of one arena follow each other
+        int arena_index = mm_arena_of(ptrs[i]);
+        heap_ctl_t* arena = arena_ctl(arena_index);
+        if (arena != home) {
+            // link them in order and push them on the owner's remote stack in one go
+            void* first = ptrs[i++];
+            void* last = first;
+            while (i < n && mm_arena_of(ptrs[i]) == arena_index) {
+                *(void**)last = ptrs[i];
+                last = ptrs[i++];
+            }
+            remote_push_chain(arena, first, last);
+            continue;
+        }
+        ctl = arena;
+        spin_lock(&arena->lock);
+        remote_drain();
+        while (i < n && mm_arena_of(ptrs[i]) == arena_index) {
+            void* ptr = ptrs[i++];
+            if (slab_of(ptr) != NULL) {
+                arena_free(ptr);
+                continue;
+            }
+            void* block = ptr - headerORFooter_SIZE;
+            size_t span = extract_size(block);
+            while (i < n && ptrs[i] == block + span + 2 * headerORFooter_SIZE && slab_of(ptrs[i]) == NULL) {
+                span += extract_size(ptrs[i] - headerORFooter_SIZE) + headerORFooter_SIZE;
+                i++;
+            }
+            set(block, ((span << 1) | 0x01) << 1 | extract_prev_bits(block));
+            arena_free(ptr);
+        }
+        spin_unlock(&arena->lock);
+    }
+    ctl = home;
+}
+
+/*
+ * mm_malloc_usable_size : the bytes the block of ptr can hold, 0 for NULL
+ * Read from the block's header (or the mapping's, or the slot size of its slab), so it
+ * includes what alignx and an unsplit free block added to the request
+ */
+size_t mm_malloc_usable_size(void* ptr)
+{
+    if (ptr == NULL) {
+        return 0;
+    }
+    if (is_mapped(ptr)) {
+        return extract_size(ptr - headerORFooter_SIZE);
+    }
+    thread_enter();
+    ctl = arena_ctl(mm_arena_of(ptr));
+    slab_t* slab = slab_of(ptr);
+    if (slab != NULL) {
+        return slab->slot_size;
+    }
+    return extract_size(ptr - headerORFooter_SIZE);
+}
+
+/*
+ * mm_good_size : the usable size malloc gives a request of size bytes: the slot size of its
+ * slab class, or its aligned block size. A slab-sized request may get a block until its class
+ * warms up (slab_malloc), so it gets the smaller of the two. A block may still come out larger
+ * (an unsplit free block, a mapping rounded to pages), never smaller
+ */
+size_t mm_good_size(size_t size)
+{
+    thread_enter();
+    if (size <= ctl->slab_max) {
+        size_t slot_size = size == 0 ? ALIGNMENT : (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        return slot_size < alignx(size) ? slot_size : alignx(size);
+    }
+    return alignx(size);
+}
+
+/*
+ * mm_fit_policy : the fit (MM_FIT_*) the caller's arena uses now for the list a request of
+ * size bytes searches first, MM_FIT_TLSF if TLSF is the index, or -1 if that is the large
+ * block tree
+ */
+int mm_fit_policy(size_t size)
+{
+    thread_enter();
+    heap_ctl_t* arena = ctl;
+    spin_lock(&arena->lock);
+    int fit = -1;
+    int i = get_free_list_index(alignx(size));
+    if (arena->tlsf) {
+        fit = MM_FIT_TLSF;
+    } else if (i != LARGE_TREE_CLASS) {
+        fit = arena->fit != NULL ? arena->fit[i].fit : MM_FIT_FIRST;
+    }
+    spin_unlock(&arena->lock);
+    return fit;
+}
+
+/*
+ * mm_memalign : allocates size bytes whose address is a multiple of alignment (a power of
+ * two), NULL if it is not one or memory ran out. Up to ALIGNMENT every block is aligned
+ * already. Larger alignments are cut out of a free block of the arena, with the gap in front
+ * and the rest after it freed again, so the block is an ordinary one for free, realloc (which
+ * keeps the alignment only while the block stays in place) and the heap checker. A request
+ * of at least the mmap threshold that no free block fits gets a mapping of its own instead,
+ * if the alignment is at most a page: the payload sits at an aligned offset in it, which
+ * mmap_realloc keeps. They are never slots, whose payloads sit at fixed offsets
+ */
+void* mm_memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return malloc(size);
+    }
+    if (size >= SIZE_MAX / 2 - alignment) {
+        return NULL;
     }
+    thread_enter();
+    heap_ctl_t* arena = ctl;
+    spin_lock(&arena->lock);
+    remote_drain();
+    mm_checkheap(__LINE__);
+    ctl->mallocs++;
+    void* ptr = alloc_aligned_block(size, alignment);
+    spin_unlock(&arena->lock);
     return ptr;
 }
 
+/*
+ * aligned_alloc : C11 aligned allocation, the same as mm_memalign. The size does not have to
+ * be a multiple of the alignment
+ */
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+/*
+ * posix_memalign : stores a block of size bytes aligned to alignment in *memptr and returns 0,
+ * or returns EINVAL if alignment is not a power of two multiple of sizeof(void*), ENOMEM if
+ * memory ran out (*memptr is left alone then)
+ */
+int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* ptr = mm_memalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
 /*
  * Returns whether the pointer is in the heap.
  * May be useful for debugging.
  */
 static bool in_heap(const void* p)
 {
-    return p <= mm_heap_hi() && p >= mm_heap_lo();
+    return p <= heap_hi() && p >= heap_lo();
 }
 
 /*
@@ -705,6 +3131,29 @@ static bool aligned(const void* p)
     return align(ip) == ip;
 }
 
+/*
+ * Returns whether a free block marked zero reads zero apart from its links and footer.
+ * Only the first and last 4 KB of that are looked at, a heap check runs very often.
+ */
+static bool reads_zero(void* block)
+{
+    size_t size = extract_size(block);
+    if ((*(uint8_t*)(block + size) & ZERO_BIT) == 0) {
+        return false;
+    }
+    uint8_t* lo = (uint8_t*)block + headerORFooter_SIZE + ZERO_SKIP;
+    uint8_t* hi = (uint8_t*)block + size;
+    for (uint8_t* p = lo; p < hi; p++) {
+        if (p == lo + 4096 && hi - 4096 > p) {
+            p = hi - 4096;
+        }
+        if (*p != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /*
  * mm_checkheap
  * You call theHelper function via mm_checkheap(__LINE__)
@@ -717,14 +3166,21 @@ bool mm_checkheap(int line_number)
     // Write code to check heap invariants here
     // IMPLEMENT THIS
    // CHeck freelist
-    for (int i = 0; i < NUM_FREE_LISTS; i++) {
-        void* fb = free_lists[i];
+    void** lists = ctl->free_lists;
+    int num_lists = LARGE_TREE_CLASS; // the last class is a tree, checked below
+    if (ctl->tlsf) {
+        lists = &tlsf_index()->heads[0][0];
+        num_lists = TLSF_FL_COUNT * TLSF_SL_COUNT;
+    }
+    for (int i = 0; i < num_lists; i++) {
+        void* fb = lists[i];
+        size_t length = 0;
         while (fb != NULL) {
             if (!in_heap(fb)) {
                 dbg_printf("Error: block %p is not in heap at line %d\n", fb, line_number);
                 return false;
             }
-            if (!aligned(fb)) {
+            if (!aligned(fb + headerORFooter_SIZE)) {
                 dbg_printf("Error: block %p is not aligned at line %d\n", fb, line_number);
                 return false;
             }
@@ -733,22 +3189,181 @@ bool mm_checkheap(int line_number)
                 return false;
             }
             
-            if (extract_size(fb) < 24) {
-                dbg_printf("Error: block %p has size less than 24 at line %d\n", fb, line_number);
+            if (extract_size(fb) < ctl->min_block) {
+                dbg_printf("Error: block %p is smaller than the minimum block at line %d\n", fb, line_number);
+                return false;
+            }
+            // the block after it (or the epilogue) must say whether this is a minimum block
+            void* next_block = fb + extract_size(fb) + headerORFooter_SIZE;
+            if (((*(uint8_t*)next_block & PREV_MIN) != 0) != (extract_size(fb) == MIN_BLOCK_COMPACT)) {
+                dbg_printf("Error: block after %p has a wrong prev_min bit at line %d\n", fb, line_number);
+                return false;
+            }
+            if (extract_zero(fb) && !reads_zero(fb)) {
+                dbg_printf("Error: block %p is marked zero but does not read zero at line %d\n", fb, line_number);
+                return false;
+            }
+            if (free_list_head(extract_size(fb)) != &lists[i]) {
+                dbg_printf("Error: block %p is in the wrong free list at line %d\n", fb, line_number);
+                return false;
+            }
+            void* next = extract_next_free_blk(fb);
+            if (ctl->fit != NULL && ctl->fit[i].fit == MM_FIT_ADDRESS && next != NULL && next < fb) {
+                dbg_printf("Error: address-ordered list %d is out of order at %p at line %d\n", i, fb, line_number);
+                return false;
+            }
+            length++;
+            fb = next;
+        }
+        if (ctl->fit != NULL && length != ctl->fit[i].length) {
+            dbg_printf("Error: list %d holds %zu blocks, not %u at line %d\n", i, length, ctl->fit[i].length, line_number);
+            return false;
+        }
+    }
+    // Check the large block tree: walk it in order and check the order, the links and the blocks
+    if (!ctl->tlsf) {
+        void* node = ctl->free_lists[LARGE_TREE_CLASS];
+        void* prev = NULL;
+        if (node != NULL && tree_parent(node) != NULL) {
+            dbg_printf("Error: large block tree root %p has a parent at line %d\n", node, line_number);
+            return false;
+        }
+        while (node != NULL && tree_left(node) != NULL) node = tree_left(node);
+        while (node != NULL) {
+            if (!in_heap(node) || extract_curr_is_free(node) != 0) {
+                dbg_printf("Error: tree node %p is not a free heap block at line %d\n", node, line_number);
+                return false;
+            }
+            if (extract_zero(node) && !reads_zero(node)) {
+                dbg_printf("Error: tree node %p is marked zero but does not read zero at line %d\n", node, line_number);
+                return false;
+            }
+            if (get_free_list_index(extract_size(node)) != LARGE_TREE_CLASS) {
+                dbg_printf("Error: tree node %p is too small for the tree at line %d\n", node, line_number);
+                return false;
+            }
+            if (prev != NULL && !tree_less(prev, node)) {
+                dbg_printf("Error: tree node %p is out of order at line %d\n", node, line_number);
+                return false;
+            }
+            if ((tree_left(node) != NULL && tree_parent(tree_left(node)) != node) ||
+                (tree_right(node) != NULL && tree_parent(tree_right(node)) != node)) {
+                dbg_printf("Error: tree node %p has a bad child link at line %d\n", node, line_number);
+                return false;
+            }
+            // in-order successor
+            prev = node;
+            if (tree_right(node) != NULL) {
+                node = tree_right(node);
+                while (tree_left(node) != NULL) node = tree_left(node);
+            } else {
+                while (tree_parent(node) != NULL && tree_right(tree_parent(node)) == node) node = tree_parent(node);
+                node = tree_parent(node);
+            }
+        }
+    }
+    // Check the TLSF bitmaps: a bit is set exactly when its list (or first level) is not empty
+    if (ctl->tlsf) {
+        for (int fl = 0; fl < TLSF_FL_COUNT; fl++) {
+            for (int sl = 0; sl < TLSF_SL_COUNT; sl++) {
+                bool bit = (tlsf_index()->sl_bitmap[fl] >> sl) & 1;
+                if (bit != (tlsf_index()->heads[fl][sl] != NULL)) {
+                    dbg_printf("Error: TLSF bitmap bit (%d, %d) is wrong at line %d\n", fl, sl, line_number);
+                    return false;
+                }
+            }
+            bool bit = (tlsf_index()->fl_bitmap >> fl) & 1;
+            if (bit != (tlsf_index()->sl_bitmap[fl] != 0)) {
+                dbg_printf("Error: TLSF first-level bit %d is wrong at line %d\n", fl, line_number);
+                return false;
+            }
+        }
+    }
+    // Check the slabs: every slab with a free slot is in its class's list, in address order,
+    // marked in the page map, inside an allocated block, and its free count matches the bitmap
+    for (int c = 0; c < SLAB_NUM_CLASSES; c++) {
+        for (slab_t* slab = ctl->slabs[c]; slab != NULL; slab = slab->next) {
+            if (!in_heap(slab) || (uintptr_t)slab % SLAB_PAGE_SIZE != 0 || slab_of(slab) != slab) {
+                dbg_printf("Error: slab %p is not a slab page at line %d\n", slab, line_number);
+                return false;
+            }
+            if (extract_curr_is_free((char*)slab - headerORFooter_SIZE) != 1) {
+                dbg_printf("Error: slab %p is not in an allocated block at line %d\n", slab, line_number);
+                return false;
+            }
+            if (slab->slot_size != (c + 1) * ALIGNMENT || (slab->next != NULL && (slab->next <= slab || slab->next->prev != slab))) {
+                dbg_printf("Error: slab %p is in the wrong place in the slab lists at line %d\n", slab, line_number);
+                return false;
+            }
+            int used = 0;
+            for (int w = 0; w < 4; w++) {
+                used += __builtin_popcountll(slab->used[w]);
+            }
+            if (slab->num_free == 0 || slab->num_free != slab->num_slots - used) {
+                dbg_printf("Error: slab %p has a wrong free slot count at line %d\n", slab, line_number);
                 return false;
             }
-            fb = extract_next_free_blk(fb);
         }
     }
+    // Check this thread's cache: allocated blocks of the bin's size, as many as the count says
+    if (tcache != NULL) {
+        for (int bin = 0; bin < TCACHE_NUM_BINS; bin++) {
+            int count = 0;
+            for (void* ptr = tcache->heads[bin]; ptr != NULL; ptr = *(void**)ptr) {
+                // a sized free may file a block under a smaller bin than its own size
+                if (mm_arena_of(ptr) < 0 || !aligned(ptr) || extract_curr_is_free(ptr - headerORFooter_SIZE) != 1 ||
+                    extract_size(ptr - headerORFooter_SIZE) < TCACHE_MIN_SIZE + (size_t)bin * ALIGNMENT) {
+                    dbg_printf("Error: cached block %p is not an allocated block of its bin at line %d\n", ptr, line_number);
+                    return false;
+                }
+                count++;
+            }
+            if (count != tcache->counts[bin]) {
+                dbg_printf("Error: tcache bin %d holds %d blocks, its count is %d at line %d\n", bin, count, tcache->counts[bin], line_number);
+                return false;
+            }
+        }
+    }
+    // Check the remote stack: blocks (or slots) of this arena that are still allocated.
+    // Other threads may push meanwhile, but only the lock holder pops, so the walk is safe
+    for (void* ptr = __atomic_load_n(&ctl->remote_frees, __ATOMIC_ACQUIRE); ptr != NULL; ptr = *(void**)ptr) {
+        if (mm_arena_of(ptr) != ctl->arena ||
+            (slab_of(ptr) == NULL && (!aligned(ptr) || extract_curr_is_free(ptr - headerORFooter_SIZE) != 1))) {
+            dbg_printf("Error: remote free %p is not an allocated block of this arena at line %d\n", ptr, line_number);
+            return false;
+        }
+    }
+    // Check the quick lists: allocated blocks of the bin's size, as many bytes as the count says
+    size_t quick_bytes = 0;
+    for (int bin = 0; bin < TCACHE_NUM_BINS; bin++) {
+        for (void* ptr = ctl->quick != NULL ? ctl->quick[bin] : NULL; ptr != NULL; ptr = *(void**)ptr) {
+            if (!in_heap(ptr) || !aligned(ptr) || extract_curr_is_free(ptr - headerORFooter_SIZE) != 1 ||
+                tcache_bin(extract_size(ptr - headerORFooter_SIZE)) != bin) {
+                dbg_printf("Error: quick-listed block %p is not an allocated block of its bin at line %d\n", ptr, line_number);
+                return false;
+            }
+            quick_bytes += extract_size(ptr - headerORFooter_SIZE) + headerORFooter_SIZE;
+        }
+    }
+    if (quick_bytes != ctl->quick_bytes) {
+        dbg_printf("Error: quick lists hold %zu bytes, their count is %u at line %d\n", quick_bytes, ctl->quick_bytes, line_number);
+        return false;
+    }
     // Check the epilogue block
-    char* epilogue = mm_heap_hi() - 7;
-    if (*epilogue != 0x01) {
+    char* epilogue = heap_hi() - 7;
+    if ((*epilogue & ~(0x01 | PREV_MIN)) != 0) {
         dbg_printf("Error: epilogue block has been overwritten at line %d\n", line_number);
         return false;
     }
+    // its prev_is_free bit is clear exactly when the heap ends in a block of the free index
+    void* last = last_free_block();
+    if (last != NULL && (last < ctl->heap_start || extract_curr_is_free(last) != 0 || !in_free_index(last))) {
+        dbg_printf("Error: epilogue says the last block is free, %p is not at line %d\n", last, line_number);
+        return false;
+    }
     // Check the prologue block
-    char* prologueh = mm_heap_lo() + headerORFooter_SIZE;
-    char* prologuef = mm_heap_lo() + 2 * headerORFooter_SIZE;
+    char* prologueh = (char*)ctl->heap_start - 2 * headerORFooter_SIZE;
+    char* prologuef = (char*)ctl->heap_start - headerORFooter_SIZE;
     if (*prologueh != 0x11 || *prologuef != 0x11) {
         dbg_printf("Error: prologue block has been overwritten at line %d\n", line_number);
         return false;
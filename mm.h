@@ -8,6 +8,8 @@ extern void* mm_malloc (size_t size);
 extern void mm_free (void* ptr);
 extern void* mm_realloc(void* ptr, size_t size);
 extern void* mm_calloc (size_t nmemb, size_t size);
+extern void* mm_aligned_alloc(size_t alignment, size_t size);
+extern int mm_posix_memalign(void** memptr, size_t alignment, size_t size);
 
 #else
 
@@ -16,10 +18,74 @@ extern void* malloc (size_t size);
 extern void free (void* ptr);
 extern void* realloc(void* ptr, size_t size);
 extern void* calloc (size_t nmemb, size_t size);
+extern void* aligned_alloc(size_t alignment, size_t size);
+extern int posix_memalign(void** memptr, size_t alignment, size_t size);
 
 #endif
 
 extern bool mm_init(void);
 
+/* Tunables for mm_mallopt.  They take effect at the next mm_init, for every arena of the new heap */
+#define MM_OPT_POLICY          1   /* free-block index, one of MM_POLICY_* */
+#define MM_OPT_SLAB_MAX        2   /* requests up to this many bytes (at most 64) use slabs, 0 = off */
+#define MM_OPT_TCACHE_COUNT    3   /* freed blocks each per-thread cache bin keeps (at most 255), 0 = off */
+#define MM_OPT_MMAP_THRESHOLD  4   /* requests of at least this many bytes get their own mapping, 0 = off */
+#define MM_OPT_TRIM_THRESHOLD  5   /* free trims a free heap tail of at least this many bytes, 0 = off */
+#define MM_OPT_PURGE_THRESHOLD 6   /* free decommits the pages inside free blocks this large, 0 = off */
+#define MM_OPT_GROW_MAX        7   /* largest chunk the heap grows by beyond a request, 0 = exact growth */
+#define MM_OPT_QUICK_BUDGET    8   /* bytes of small freed blocks kept uncoalesced per arena, 0 = off */
+#define MM_OPT_LAYOUT          9   /* free block layout, one of MM_LAYOUT_* */
+#define MM_OPT_FIT_ADAPT      10   /* 1: each class picks its fit once the heap is 256KB (default), 0: first fit */
+
+#define MM_POLICY_SEGLIST  0   /* segregated power-of-two lists, first fit (default) */
+#define MM_POLICY_TLSF     1   /* two-level segregated fit with bitmaps, O(1) search */
+
+#define MM_LAYOUT_WIDE     0   /* 8-byte free-list pointers, 24-byte minimum blocks (default) */
+#define MM_LAYOUT_COMPACT  1   /* 4-byte heap-relative links, 8-byte minimum blocks without a footer */
+
+#define MM_FIT_FIRST       0   /* the first block that fits, lists in LIFO order */
+#define MM_FIT_BEST_OF     1   /* the smallest of the first few blocks that fit */
+#define MM_FIT_ADDRESS     2   /* the first block that fits, lists in address order */
+#define MM_FIT_TLSF        3   /* MM_POLICY_TLSF: no fit per list, the two-level index finds a good fit */
+
+/* Set a tunable.  Returns false if the parameter or value is invalid */
+extern bool mm_mallopt(int param, int value);
+
+/* Give the free tail of the heap back to memlib, keeping pad bytes of it.
+ * Returns true if the heap shrank */
+extern bool mm_trim(size_t pad);
+
+/* Free a block whose requested size (of its malloc or last realloc) is known.
+ * Skips reading the block's metadata where the size tells enough */
+extern void mm_free_sized(void* ptr, size_t size);
+
+/* Allocate n blocks of size bytes each into out, split off one run of the heap.
+ * Returns how many were allocated, fewer than n only if memory ran out */
+extern size_t mm_malloc_batch(size_t size, size_t n, void** out);
+
+/* Free n blocks at once (NULL entries are skipped).  Sorts ptrs by address, so
+ * blocks next to each other are coalesced once */
+extern void mm_free_batch(void** ptrs, size_t n);
+
+/* Bytes the block of ptr can hold, which may be more than was asked for (0 for NULL) */
+extern size_t mm_malloc_usable_size(void* ptr);
+
+/* Bytes malloc would make usable for a request of size: what mm_malloc_usable_size
+ * returns for the new block, unless that block comes out larger */
+extern size_t mm_good_size(size_t size);
+
+/* Allocate size bytes at a multiple of alignment, a power of two.  Returns NULL
+ * if alignment is not one.  aligned_alloc and posix_memalign are built on it */
+extern void* mm_memalign(size_t alignment, size_t size);
+
+/* malloc for a request whose thread cache bin is bin.  MM_MALLOC of mm_inline.h
+ * calls it with the bin folded from a constant size */
+extern void* mm_malloc_class(size_t size, int bin);
+
+/* The fit (MM_FIT_*) the caller's arena uses now for the size class a request of size
+ * bytes searches first.  MM_FIT_TLSF if MM_POLICY_TLSF is used, -1 if that class is the
+ * large block tree */
+extern int mm_fit_policy(size_t size);
+
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int line_number);
@@ -0,0 +1,50 @@
+#ifndef MM_INLINE_H
+#define MM_INLINE_H
+
+#include "mm.h"
+
+/* Fast path for malloc calls whose size is a compile-time constant.
+ *
+ * MM_MALLOC(size) works out the block size and the thread cache bin of a
+ * constant request while compiling, and calls mm_malloc_class, which pops
+ * that bin without any size arithmetic.  Any other request, or a constant
+ * outside the cached sizes, goes to the generic malloc.  mm.c includes
+ * this header too, so the rounding here is the rounding it uses */
+
+/* Blocks are 8 + 16n bytes: a header plus a 16-byte aligned payload */
+#define MM_ALIGNMENT          16
+#define MM_CACHE_MIN_BLOCK    24    /* smallest block the thread cache keeps */
+#define MM_CACHE_MAX_BLOCK    264   /* largest block the thread cache keeps */
+#define MM_CACHE_BINS         ((MM_CACHE_MAX_BLOCK - MM_CACHE_MIN_BLOCK) / MM_ALIGNMENT + 1)
+
+/* Smallest and largest requests the fast path takes.  Requests of at most
+ * 8 bytes round differently with the compact layout (see alignx in mm.c) */
+#define MM_INLINE_MIN_REQUEST 9
+#define MM_INLINE_MAX_REQUEST MM_CACHE_MAX_BLOCK
+
+/* Block size of a request of more than 8 bytes, under either layout */
+static inline size_t mm_block_size(size_t size)
+{
+    return 8 + MM_ALIGNMENT * ((size + MM_ALIGNMENT - 1 - 8) / MM_ALIGNMENT);
+}
+
+/* Thread cache bin of a block size from MM_CACHE_MIN_BLOCK to MM_CACHE_MAX_BLOCK */
+static inline int mm_cache_bin(size_t block_size)
+{
+    return (int)((block_size - MM_CACHE_MIN_BLOCK) / MM_ALIGNMENT);
+}
+
+#ifdef DRIVER
+#define MM_GENERIC_MALLOC mm_malloc
+#else
+#define MM_GENERIC_MALLOC malloc
+#endif
+
+/* The condition folds to a constant, so only one of the calls is compiled */
+#define MM_MALLOC(size)                                                     \
+    ((__builtin_constant_p(size) && (size) >= MM_INLINE_MIN_REQUEST &&      \
+      (size) <= MM_INLINE_MAX_REQUEST)                                      \
+     ? mm_malloc_class((size), mm_cache_bin(mm_block_size(size)))          \
+     : MM_GENERIC_MALLOC(size))
+
+#endif /* MM_INLINE_H */
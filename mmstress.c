@@ -0,0 +1,321 @@
+/*
+ * mmstress.c - runs threads against mm.c at once, which mdriver cannot:
+ * it replays a trace from a single thread.
+ *
+ * Each thread keeps a table of blocks filled with a tag byte and picks a
+ * random slot per step: an empty slot gets a malloc, calloc or memalign
+ * block, a full one is checked, then reallocated or freed (mm_free or
+ * mm_free_sized).  A quarter of the frees instead leave the block in a
+ * handoff slot of a random thread, which frees it later, so blocks are
+ * freed by threads of other arenas.  Now and then a batch is allocated,
+ * part of it swapped with handed-off blocks, and freed as one batch.
+ * A block whose bytes changed, an unaligned block or a calloc block
+ * that is not zero ends the test with an error.
+ *
+ * Before that, with each layout, MM_MALLOC of mm_inline.h is called with
+ * every constant size it takes (9 to 264 bytes) and checked against
+ * mm_malloc: it must give at least the usable size mm_malloc promises,
+ * and pop the block mm_malloc(n) just left in the thread cache.
+ *
+ * usage: mmstress [-c] [-t threads] [-n steps] [-r rounds]
+ *                 [-m mmap_threshold] [-p purge_threshold]
+ *   -c  compact layout (MM_LAYOUT_COMPACT)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "memlib.h"
+#include "mm_inline.h"
+
+#define MAX_THREADS   64
+#define SLOTS         2048      /* blocks a thread keeps */
+#define HANDOFFS      64        /* handoff slots per thread */
+#define BATCH         16        /* blocks per batch */
+#define SMALL_MAX     300       /* most requests are up to this many bytes */
+#define LARGE_MAX     20000     /* one in eight is up to this many */
+#define REALLOC_MAX   600
+#define ALIGN_MIN     32        /* memalign asks for 32 to 4096 */
+#define SLAB_MAX      64        /* default of MM_OPT_SLAB_MAX */
+
+static int threads = 8;
+static long steps = 200000;
+
+/* blocks waiting for their thread to free them */
+static void *volatile handoff[MAX_THREADS][HANDOFFS];
+
+typedef struct {
+    int id;
+    unsigned seed;
+} worker_t;
+
+static unsigned rnd(unsigned *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+static void fail(int id, const char *what)
+{
+    fprintf(stderr, "thread %d: %s\n", id, what);
+    exit(1);
+}
+
+static bool holds(const unsigned char *p, size_t size, unsigned char tag)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (p[i] != tag)
+            return false;
+    }
+    return true;
+}
+
+/* leave ptr in a random handoff slot, freeing what was there */
+static void hand_off(worker_t *w, void *ptr)
+{
+    void *volatile *slot = &handoff[rnd(&w->seed) % threads][rnd(&w->seed) % HANDOFFS];
+    void *old = __atomic_exchange_n(slot, ptr, __ATOMIC_ACQ_REL);
+    if (old != NULL)
+        mm_free(old);
+}
+
+static size_t request_size(worker_t *w, size_t small_max)
+{
+    if (rnd(&w->seed) % 8 == 0)
+        return rnd(&w->seed) % LARGE_MAX + 1;
+    return rnd(&w->seed) % small_max + 1;
+}
+
+/*
+ * batch - allocate a batch, check it, swap a quarter of it with handed-off
+ *         blocks and free it as one batch
+ */
+static void batch(worker_t *w)
+{
+    void *b[BATCH];
+    size_t size = request_size(w, SMALL_MAX);
+    if (mm_malloc_batch(size, BATCH, b) != BATCH)
+        fail(w->id, "mm_malloc_batch ran out of memory");
+    for (int i = 0; i < BATCH; i++) {
+        if ((uintptr_t) b[i] % 16 != 0)
+            fail(w->id, "batch block is not 16-byte aligned");
+        memset(b[i], i, size);
+    }
+    for (int i = 0; i < BATCH; i++) {
+        if (!holds(b[i], size, i))
+            fail(w->id, "batch block was overwritten");
+    }
+    for (int i = 0; i < BATCH; i += 4) {
+        void *volatile *slot = &handoff[rnd(&w->seed) % threads][rnd(&w->seed) % HANDOFFS];
+        b[i] = __atomic_exchange_n(slot, b[i], __ATOMIC_ACQ_REL);
+    }
+    mm_free_batch(b, BATCH);
+}
+
+static void *run(void *arg)
+{
+    worker_t *w = arg;
+    void *ptr[SLOTS] = { NULL };
+    size_t size[SLOTS];
+    unsigned char tag[SLOTS];
+
+    for (long step = 0; step < steps; step++) {
+        int k = rnd(&w->seed) % SLOTS;
+        if (ptr[k] != NULL) {
+            if (!holds(ptr[k], size[k], tag[k]))
+                fail(w->id, "block was overwritten");
+            switch (rnd(&w->seed) % 4) {
+            case 0:
+                hand_off(w, ptr[k]);
+                ptr[k] = NULL;
+                break;
+            case 1: {
+                size_t new_size = rnd(&w->seed) % REALLOC_MAX + 1;
+                void *q = mm_realloc(ptr[k], new_size);
+                if (q == NULL)
+                    fail(w->id, "mm_realloc ran out of memory");
+                if (!holds(q, new_size < size[k] ? new_size : size[k], tag[k]))
+                    fail(w->id, "mm_realloc lost the payload");
+                memset(q, tag[k], new_size);
+                ptr[k] = q;
+                size[k] = new_size;
+                break;
+            }
+            case 2:
+                mm_free_sized(ptr[k], size[k]);
+                ptr[k] = NULL;
+                break;
+            default:
+                mm_free(ptr[k]);
+                ptr[k] = NULL;
+                break;
+            }
+        } else {
+            size_t n = request_size(w, SMALL_MAX);
+            size_t alignment = rnd(&w->seed) % 16 == 0 ? (size_t) ALIGN_MIN << (rnd(&w->seed) % 8) : 0;
+            bool zero = alignment == 0 && rnd(&w->seed) % 8 == 0;
+            void *p = alignment != 0 ? mm_memalign(alignment, n) : zero ? mm_calloc(1, n) : mm_malloc(n);
+            if (p == NULL)
+                fail(w->id, "out of memory");
+            if ((uintptr_t) p % 16 != 0 || (alignment != 0 && (uintptr_t) p % alignment != 0))
+                fail(w->id, "block is not aligned");
+            if (zero && !holds(p, n, 0))
+                fail(w->id, "mm_calloc block is not zero");
+            ptr[k] = p;
+            size[k] = n;
+            tag[k] = rnd(&w->seed);
+            memset(p, tag[k], n);
+        }
+        if (rnd(&w->seed) % 64 == 0)
+            batch(w);
+        /* free what other threads left here */
+        for (int i = 0; i < 2; i++) {
+            void *volatile *slot = &handoff[w->id][rnd(&w->seed) % HANDOFFS];
+            void *h = __atomic_exchange_n(slot, NULL, __ATOMIC_ACQ_REL);
+            if (h != NULL)
+                mm_free(h);
+        }
+    }
+    for (int k = 0; k < SLOTS; k++) {
+        if (ptr[k] != NULL)
+            mm_free(ptr[k]);
+    }
+    return NULL;
+}
+
+/*
+ * check_inline - p is MM_MALLOC(n), q the block mm_malloc(n) gave and freed
+ *                right before it, which the thread cache still holds
+ */
+static void check_inline(size_t n, void *p, void *q)
+{
+    if (p == NULL || (uintptr_t) p % 16 != 0)
+        fail(0, "MM_MALLOC gave no aligned block");
+    if (mm_malloc_usable_size(p) < mm_good_size(n))
+        fail(0, "MM_MALLOC gave a smaller block than mm_malloc");
+    /* a block of exactly the class size is in the bin MM_MALLOC folded n to */
+    if (mm_malloc_usable_size(q) == mm_good_size(n) && p != q)
+        fail(0, "MM_MALLOC missed the thread cache bin of mm_malloc");
+    memset(p, 0x5a, n);
+    mm_free(p);
+}
+
+#define INLINE(n)                                                       \
+    do {                                                                \
+        void *q = mm_malloc(n);                                         \
+        mm_free(q);                                                     \
+        check_inline(n, MM_MALLOC(n), q);                               \
+    } while (0)
+
+#define INLINE16(n)                                                     \
+    do {                                                                \
+        INLINE(n);      INLINE(n + 1);  INLINE(n + 2);  INLINE(n + 3);  \
+        INLINE(n + 4);  INLINE(n + 5);  INLINE(n + 6);  INLINE(n + 7);  \
+        INLINE(n + 8);  INLINE(n + 9);  INLINE(n + 10); INLINE(n + 11); \
+        INLINE(n + 12); INLINE(n + 13); INLINE(n + 14); INLINE(n + 15); \
+    } while (0)
+
+/*
+ * inline_sizes - MM_MALLOC with every constant size it takes, from a heap
+ *                of the given layout without slabs, so each size is cached
+ */
+static void inline_sizes(int layout)
+{
+    mem_reset_brk();
+    mm_mallopt(MM_OPT_LAYOUT, layout);
+    mm_mallopt(MM_OPT_SLAB_MAX, 0);
+    if (!mm_init()) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    INLINE16(9);   INLINE16(25);  INLINE16(41);  INLINE16(57);
+    INLINE16(73);  INLINE16(89);  INLINE16(105); INLINE16(121);
+    INLINE16(137); INLINE16(153); INLINE16(169); INLINE16(185);
+    INLINE16(201); INLINE16(217); INLINE16(233); INLINE16(249);
+    mm_mallopt(MM_OPT_SLAB_MAX, SLAB_MAX);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-c] [-t threads] [-n steps] [-r rounds] "
+            "[-m mmap_threshold] [-p purge_threshold]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = 3;
+    int layout = MM_LAYOUT_WIDE;
+    int c;
+
+    mem_init();
+    while ((c = getopt(argc, argv, "ct:n:r:m:p:")) != EOF) {
+        switch (c) {
+        case 'c':
+            layout = MM_LAYOUT_COMPACT;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1 || threads > MAX_THREADS)
+                usage(argv[0]);
+            break;
+        case 'n':
+            steps = atol(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'm':
+            if (!mm_mallopt(MM_OPT_MMAP_THRESHOLD, atoi(optarg)))
+                usage(argv[0]);
+            break;
+        case 'p':
+            if (!mm_mallopt(MM_OPT_PURGE_THRESHOLD, atoi(optarg)))
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    inline_sizes(MM_LAYOUT_WIDE);
+    inline_sizes(MM_LAYOUT_COMPACT);
+    printf("MM_MALLOC matches mm_malloc for %d to %d bytes with both layouts\n",
+           MM_INLINE_MIN_REQUEST, MM_INLINE_MAX_REQUEST);
+    mm_mallopt(MM_OPT_LAYOUT, layout);
+
+    for (int round = 0; round < rounds; round++) {
+        mem_reset_brk();
+        if (!mm_init()) {
+            fprintf(stderr, "mm_init failed\n");
+            exit(1);
+        }
+        pthread_t tid[MAX_THREADS];
+        worker_t w[MAX_THREADS];
+        for (int i = 0; i < threads; i++) {
+            w[i].id = i;
+            w[i].seed = i * 7919 + round + 1;
+            pthread_create(&tid[i], NULL, run, &w[i]);
+        }
+        for (int i = 0; i < threads; i++)
+            pthread_join(tid[i], NULL);
+        for (int i = 0; i < threads; i++) {
+            for (int j = 0; j < HANDOFFS; j++) {
+                if (handoff[i][j] != NULL) {
+                    mm_free(handoff[i][j]);
+                    handoff[i][j] = NULL;
+                }
+            }
+        }
+        size_t heap = 0;
+        for (int a = 0; a < MEM_MAX_ARENAS; a++)
+            heap += mm_arena_size(a);
+        printf("round %d: %d threads, %ld steps each, heaps %zu bytes\n", round, threads, steps, heap);
+    }
+    mem_deinit();
+    return 0;
+}